@@ -0,0 +1,98 @@
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include "map_processing.h"
+
+using map_processing::IO::MappedReadFile;
+using map_processing::IO::RunLengthReadFile;
+using map_processing::processing_types::HouseStationMap;
+using map_processing::processing_types::TextData;
+namespace run_length_format = map_processing::IO::run_length_format;
+
+namespace {
+    // the cells [x0, x0 + width) x [y0, y0 + height) of the map in the raw format
+    bool write_raw(const std::string &path, const HouseStationMap &hs_map, uint32_t x0, uint32_t y0, uint32_t width,
+                   uint32_t height) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&width), sizeof(width));
+        file.write(reinterpret_cast<const char *>(&height), sizeof(height));
+        for (uint32_t y = y0; y < y0 + height; y++) {
+            file.write(reinterpret_cast<const char *>(hs_map.row(y) + x0), width);
+        }
+        file.close();
+        return bool(file);
+    }
+}
+
+// raw map -> run-length map, back with --raw, or into a directory of raw <columns>x<rows> tiles with --split
+int main(int argc, char *argv[]) {
+    bool to_raw = false;
+    uint32_t columns = 0;
+    uint32_t rows = 0;
+    std::string source;
+    std::string target;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--raw") {
+            to_raw = true;
+        } else if (arg.rfind("--split=", 0) == 0) {
+            char *rest = nullptr;
+            columns = static_cast<uint32_t>(std::strtoul(arg.c_str() + 8, &rest, 10));
+            rows = *rest == 'x' ? static_cast<uint32_t>(std::strtoul(rest + 1, nullptr, 10)) : columns;
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "UNKNOWN OPTION " << arg << std::endl;
+            return 1;
+        } else if (source.empty()) {
+            source = arg;
+        } else {
+            target = arg;
+        }
+    }
+    if (target.empty()) {
+        std::cerr << "TRY *./convert_map [--raw | --split=<columns>x<rows>] 'Path_to_source_file' "
+                     "'Path_to_target_file_or_directory'*" << std::endl;
+        return 1;
+    }
+    TextData file_name;
+    file_name.text = source;
+    try {
+        bool written = true;
+        if (columns != 0 && rows != 0) {
+            // tile_<column>_<row>.dat as TiledMapProcessor reads them, the last column and row take the remainder
+            HouseStationMap hs_map = MappedReadFile().apply(file_name);
+            std::filesystem::create_directories(target);
+            uint32_t width = (hs_map.x_size + columns - 1) / columns;
+            uint32_t height = (hs_map.y_size + rows - 1) / rows;
+            for (uint32_t r = 0; r < rows && r * height < hs_map.y_size; r++) {
+                for (uint32_t c = 0; c < columns && c * width < hs_map.x_size; c++) {
+                    std::string path = (std::filesystem::path(target) /
+                                        ("tile_" + std::to_string(c) + "_" + std::to_string(r) + ".dat")).string();
+                    written = written && write_raw(path, hs_map, c * width, r * height,
+                                                   std::min(width, hs_map.x_size - c * width),
+                                                   std::min(height, hs_map.y_size - r * height));
+                }
+            }
+            if (written) {
+                return 0;
+            }
+        } else if (to_raw) {
+            HouseStationMap hs_map = MappedReadFile().apply(file_name);
+            written = write_raw(target, hs_map, 0, 0, hs_map.x_size, hs_map.y_size);
+        } else {
+            map_processing::processing_types::RunLengthMap rl_map = RunLengthReadFile().apply(file_name);
+            written = run_length_format::write(rl_map, target);
+            std::cerr << rl_map.run_count() << " runs" << std::endl;
+        }
+        if (!written) {
+            std::cerr << "Can not write " << target << std::endl;
+            return 1;
+        }
+    } catch (const map_processing::ProcessingException &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    struct stat source_stat{}, target_stat{};
+    stat(source.c_str(), &source_stat);
+    stat(target.c_str(), &target_stat);
+    std::cerr << source_stat.st_size << " -> " << target_stat.st_size << " bytes" << std::endl;
+}
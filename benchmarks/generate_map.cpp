@@ -0,0 +1,45 @@
+#include <cstdlib>
+#include <iostream>
+#include "benchmarks/map_generator.h"
+
+int main(int argc, char *argv[]) {
+    map_generator::MapSpec spec;
+    std::string path;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--size=", 0) == 0) {
+            // <side> or <x_size>x<y_size>
+            char *rest = nullptr;
+            spec.x_size = static_cast<uint32_t>(std::strtoul(arg.c_str() + 7, &rest, 10));
+            spec.y_size = *rest == 'x' ? static_cast<uint32_t>(std::strtoul(rest + 1, nullptr, 10)) : spec.x_size;
+        } else if (arg.rfind("--density=", 0) == 0) {
+            spec.house_density = std::atof(arg.c_str() + 10);
+        } else if (arg.rfind("--house-size=", 0) == 0) {
+            // <min>-<max>
+            char *rest = nullptr;
+            spec.min_house_side = static_cast<uint32_t>(std::strtoul(arg.c_str() + 13, &rest, 10));
+            spec.max_house_side = *rest == '-' ? static_cast<uint32_t>(std::strtoul(rest + 1, nullptr, 10))
+                                               : spec.min_house_side;
+        } else if (arg == "--small-houses") {
+            spec.size_distribution = map_generator::SizeDistribution::small_biased;
+        } else if (arg.rfind("--stations=", 0) == 0) {
+            spec.station_count = static_cast<uint32_t>(std::strtoul(arg.c_str() + 11, nullptr, 10));
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            spec.seed = static_cast<uint32_t>(std::strtoul(arg.c_str() + 7, nullptr, 10));
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "UNKNOWN OPTION " << arg << std::endl;
+            return 1;
+        } else if (path.empty()) {
+            path = arg;
+        }
+    }
+    if (path.empty()) {
+        std::cerr << "TRY *./generate_map [--size=<side|XxY>] [--density=<0..1>] [--house-size=<min>-<max>] "
+                     "[--small-houses] [--stations=<n>] [--seed=<n>] 'Path_to_map_file'*" << std::endl;
+        return 1;
+    }
+    if (!map_generator::write_map(path, map_generator::generate(spec))) {
+        std::cerr << "Can not write " << path << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef TEST_TASK_MAP_GENERATOR_H
+#define TEST_TASK_MAP_GENERATOR_H
+
+#include <fstream>
+#include <random>
+#include <string>
+#include "map_processing.h"
+
+// synthetic maps in the format ReadFile expects: x_size, y_size (uint32) and then one byte per cell
+namespace map_generator {
+    using map_processing::processing_types::HouseStationMap;
+
+    enum class SizeDistribution {
+        // every side in [min_house_side, max_house_side] equally likely
+        uniform,
+        // small houses much more common than large ones
+        small_biased
+    };
+
+    struct MapSpec {
+        uint32_t x_size = 1024;
+        uint32_t y_size = 1024;
+        // share of the house slots that get a house
+        double house_density = 0.3;
+        uint32_t min_house_side = 1;
+        uint32_t max_house_side = 8;
+        SizeDistribution size_distribution = SizeDistribution::uniform;
+        uint32_t station_count = 256;
+        uint32_t seed = 42;
+    };
+
+    // houses go into slots of max_house_side + 1 cells so they never touch each other; stations are dropped on
+    // empty cells with no house around them, so the tracer sees exactly the generated objects
+    inline HouseStationMap generate(const MapSpec &spec) {
+        HouseStationMap map(spec.x_size, spec.y_size);
+        uint8_t *cells = map.data();
+        std::mt19937 rng(spec.seed);
+        std::uniform_real_distribution<double> chance(0, 1);
+        const uint32_t min_side = std::max<uint32_t>(spec.min_house_side, 1);
+        const uint32_t max_side = std::max(spec.max_house_side, min_side);
+        auto side = [&] {
+            double u = chance(rng);
+            if (spec.size_distribution == SizeDistribution::small_biased) {
+                u = u * u * u;
+            }
+            return min_side + std::min(static_cast<uint32_t>(u * (max_side - min_side + 1)), max_side - min_side);
+        };
+
+        const uint32_t slot = max_side + 1;
+        for (uint32_t sy = 0; sy + slot <= spec.y_size; sy += slot) {
+            for (uint32_t sx = 0; sx + slot <= spec.x_size; sx += slot) {
+                if (chance(rng) >= spec.house_density) {
+                    continue;
+                }
+                uint32_t w = side(), h = side();
+                uint32_t x = sx + std::uniform_int_distribution<uint32_t>(0, max_side - w)(rng);
+                uint32_t y = sy + std::uniform_int_distribution<uint32_t>(0, max_side - h)(rng);
+                for (uint32_t r = y; r < y + h; r++) {
+                    std::fill_n(cells + size_t(r) * spec.x_size + x, w, 1);
+                }
+            }
+        }
+
+        if (spec.x_size == 0 || spec.y_size == 0) {
+            return map;
+        }
+        std::uniform_int_distribution<uint32_t> any_x(0, spec.x_size - 1), any_y(0, spec.y_size - 1);
+        auto free_around = [&](uint32_t x, uint32_t y) {
+            for (uint32_t r = y == 0 ? 0 : y - 1; r <= std::min(y + 1, spec.y_size - 1); r++) {
+                for (uint32_t c = x == 0 ? 0 : x - 1; c <= std::min(x + 1, spec.x_size - 1); c++) {
+                    if (cells[size_t(r) * spec.x_size + c] != 0) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        };
+        // gives up on a station after a number of misses, so an overfull map still terminates
+        for (uint32_t s = 0, misses = 0; s < spec.station_count && misses < 1000;) {
+            uint32_t x = any_x(rng), y = any_y(rng);
+            if (free_around(x, y)) {
+                cells[size_t(y) * spec.x_size + x] = 2;
+                s++;
+                misses = 0;
+            } else {
+                misses++;
+            }
+        }
+        return map;
+    }
+
+    inline bool write_map(const std::string &path, const HouseStationMap &map) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        file.write(reinterpret_cast<const char *>(&map.x_size), sizeof(map.x_size));
+        file.write(reinterpret_cast<const char *>(&map.y_size), sizeof(map.y_size));
+        file.write(reinterpret_cast<const char *>(map.row(0)),
+                   static_cast<std::streamsize>(size_t(map.x_size) * map.y_size));
+        return static_cast<bool>(file);
+    }
+}
+
+#endif //TEST_TASK_MAP_GENERATOR_H
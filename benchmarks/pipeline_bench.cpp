@@ -0,0 +1,243 @@
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <vector>
+#include "benchmarks/map_generator.h"
+#include "map_processing.h"
+
+using namespace map_processing;
+using processing_types::TextData;
+using processing_types::HouseStationMap;
+using processing_types::HouseStationSet;
+using processing_types::HouseStationTable;
+using IO::ReadFile;
+using IO::MappedReadFile;
+using processing_core::HousesStationTracer;
+using processing_core::ParallelHousesStationTracer;
+using processing_core::HouseStationSetProcessor;
+using processing_core::StagedMapProcessor;
+using tiny_database::CommandProcessor;
+using output_utils::BufferedWriter;
+
+namespace {
+    std::atomic<size_t> allocation_count{0};
+    // keeps results the timed code would otherwise throw away
+    volatile size_t found_sum = 0;
+}
+
+// every allocation made through operator new, which is all the containers and strings use; kept out of line so
+// the compiler does not pair the inlined free() with a new expression
+[[gnu::noinline]] void *operator new(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+[[gnu::noinline]] void operator delete(void *pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+namespace {
+    // counts the answer bytes instead of keeping them
+    class CountingSink : public output_utils::OutputSink {
+    public:
+        void write(const char *, size_t size) override {
+            bytes += size;
+        }
+
+        size_t bytes = 0;
+    };
+
+    struct Timing {
+        double first_ms;
+        double best_ms;
+        // operator new calls of the last run, the first one may fill caches
+        size_t allocations;
+    };
+
+    template<typename Body>
+    Timing time_runs(int repeats, Body body) {
+        Timing timing{0, 1e300, 0};
+        for (int r = 0; r < repeats; r++) {
+            size_t allocations_before = allocation_count.load(std::memory_order_relaxed);
+            auto start = std::chrono::steady_clock::now();
+            body();
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            timing.allocations = allocation_count.load(std::memory_order_relaxed) - allocations_before;
+            if (r == 0) {
+                timing.first_ms = elapsed.count();
+            }
+            timing.best_ms = std::min(timing.best_ms, elapsed.count());
+        }
+        return timing;
+    }
+}
+
+namespace {
+    // a pipeline of short commands with long answers, longer in total than one command may be, has to be
+    // answered in full while the server holds lines back for its answer backlog to drain
+    bool pipelined_answers_complete(const std::shared_ptr<HouseStationTable> &hs_table, const std::string &path) {
+        const size_t command_count = 6000;
+        UI::SocketServerUI server("unix:" + path, 2);
+        std::thread serving([&] { server.process(hs_table); });
+        socket_utils::SocketAddress address("unix:" + path);
+        int fd = -1;
+        for (int attempt = 0; fd < 0 && attempt < 1000; attempt++) {
+            try {
+                fd = socket_utils::connect_socket(address);
+            } catch (const ProcessingException &) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        size_t answers = 0;
+        if (fd >= 0) {
+            std::string commands;
+            for (size_t i = 0; i < command_count; i++) {
+                commands += "HOUSEREL ALL\n";
+            }
+            std::thread sender([&] {
+                for (size_t sent = 0; sent < commands.size();) {
+                    ssize_t put = send(fd, commands.data() + sent, commands.size() - sent, MSG_NOSIGNAL);
+                    if (put <= 0) {
+                        break;
+                    }
+                    sent += size_t(put);
+                }
+            });
+            char chunk[1 << 16];
+            ssize_t got;
+            while (answers < command_count && (got = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+                answers += size_t(std::count(chunk, chunk + got, '\0'));
+            }
+            shutdown(fd, SHUT_RDWR);
+            sender.join();
+            close(fd);
+        }
+        server.stop();
+        serving.join();
+        return answers == command_count;
+    }
+}
+
+// usage: pipeline_bench [side...], prints one CSV row per stage and map side; first_ms shows the cold run
+// (SELECT, STATTRACE and HOUSEREL answers are cached after it), best_ms the fastest of the repeats
+int main(int argc, char *argv[]) {
+    std::vector<uint32_t> sides;
+    for (int i = 1; i < argc; i++) {
+        sides.push_back(static_cast<uint32_t>(std::atoi(argv[i])));
+    }
+    if (sides.empty()) {
+        sides = {1024, 2048, 4096};
+    }
+    const int repeats = 5;
+    {
+        map_generator::MapSpec spec;
+        spec.x_size = spec.y_size = 256;
+        spec.station_count = 64;
+        HouseStationSet hs_set = HousesStationTracer().apply(map_generator::generate(spec));
+        auto hs_table = std::make_shared<HouseStationTable>(HouseStationSetProcessor().apply(hs_set));
+        std::string path = (std::filesystem::temp_directory_path() / "pipeline_bench.sock").string();
+        if (!pipelined_answers_complete(hs_table, path)) {
+            std::cerr << "SocketServerUI did not answer every pipelined command" << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "side,houses,stations,stage,first_ms,best_ms,output_bytes,allocations" << std::endl;
+    for (uint32_t side: sides) {
+        map_generator::MapSpec spec;
+        spec.x_size = spec.y_size = side;
+        spec.station_count = std::max<uint32_t>(side / 4, 1);
+        TextData path;
+        path.text = (std::filesystem::temp_directory_path() / ("pipeline_bench_" + std::to_string(side) + ".dat")).string();
+        if (!map_generator::write_map(path.text, map_generator::generate(spec))) {
+            std::cerr << "Can not write " << path.text << std::endl;
+            return 1;
+        }
+
+        HouseStationMap hs_map = MappedReadFile().apply(path);
+        HouseStationSet hs_set = HousesStationTracer().apply(hs_map);
+        auto hs_table = std::make_shared<HouseStationTable>(HouseStationSetProcessor().apply(hs_set));
+        auto report = [&](const char *stage, Timing timing, size_t output_bytes = 0) {
+            std::cout << side << ',' << hs_set.houses.size() << ',' << hs_set.stations.size() << ',' << stage << ','
+                      << timing.first_ms << ',' << timing.best_ms << ',' << output_bytes << ',' << timing.allocations
+                      << std::endl;
+        };
+
+        report("ReadFile", time_runs(repeats, [&] { ReadFile().apply(path); }));
+        report("MappedReadFile", time_runs(repeats, [&] { MappedReadFile().apply(path); }));
+        report("HousesStationTracer", time_runs(repeats, [&] { HousesStationTracer().apply(hs_map); }));
+        report("ParallelHousesStationTracer",
+               time_runs(repeats, [&] { ParallelHousesStationTracer().apply(hs_map); }));
+        report("HouseStationSetProcessor", time_runs(repeats, [&] { HouseStationSetProcessor().apply(hs_set); }));
+
+        // one row per band, so most houses are assigned before the later stations are known
+        std::shared_ptr<ProcessingData> staged;
+        report("StagedMapProcessor 1 row", time_runs(repeats, [&] {
+            staged = StagedMapProcessor(side).process(std::make_shared<TextData>(path));
+        }));
+        if (std::static_pointer_cast<HouseStationTable>(staged)->house_station != hs_table->house_station) {
+            std::cerr << "StagedMapProcessor assigned other stations than HouseStationSetProcessor" << std::endl;
+            return 1;
+        }
+
+        // nearest station of every house through the grid and each brute force kernel, for a few station counts
+        const auto default_kernel = spatial_index::nearest_kernels::active_kernel();
+        for (size_t station_count: {size_t(16), size_t(64), size_t(256), size_t(1024)}) {
+            if (station_count > hs_set.stations.size()) {
+                break;
+            }
+            // every n-th station, so they still cover the whole map
+            std::vector<processing_types::Station> stations;
+            for (size_t s = 0; s < station_count; s++) {
+                stations.push_back(hs_set.stations[s * hs_set.stations.size() / station_count]);
+            }
+            std::string stage = "nearest " + std::to_string(station_count) + " grid";
+            report(stage.c_str(), time_runs(repeats, [&] {
+                spatial_index::PointGridIndex index(stations);
+                for (const auto &house: hs_set.houses) {
+                    found_sum += index.nearest(house.x_center, house.y_center);
+                }
+            }));
+            for (auto kernel: spatial_index::nearest_kernels::available_kernels()) {
+                spatial_index::nearest_kernels::active_kernel() = kernel;
+                stage = "nearest " + std::to_string(station_count) + " " + kernel->name;
+                report(stage.c_str(), time_runs(repeats, [&] {
+                    found_sum += spatial_index::StationArrays(stations).nearest(hs_set.houses).back();
+                }));
+            }
+            spatial_index::nearest_kernels::active_kernel() = default_kernel;
+        }
+
+        CommandProcessor command_processor(hs_table);
+        const std::vector<std::string> commands = {"SELECT HOUSE 0", "SELECT STATION 0", "SHOW HOUSE", "SHOW STATION",
+                                                   "STATTRACE 0", "STATTRACE 0 TOP 10", "HOUSEREL 0", "HOUSEREL ALL",
+                                                   "NEAREST 100 100 5", "WITHIN 0 50"};
+        // the text of every command parsed 1000 times, without running them
+        report("prepare x1000", time_runs(repeats, [&] {
+            for (int r = 0; r < 1000; r++) {
+                for (const auto &command: commands) {
+                    found_sum += CommandProcessor::prepare(command).kind;
+                }
+            }
+        }));
+        for (const auto &command: commands) {
+            CountingSink sink;
+            BufferedWriter out(sink);
+            Timing timing = time_runs(repeats, [&] {
+                command_processor.process_command(command, out);
+                out.flush();
+            });
+            report(command.c_str(), timing, sink.bytes / repeats);
+        }
+        std::filesystem::remove(path.text);
+    }
+}
@@ -0,0 +1,171 @@
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "map_processing.h"
+
+using map_processing::profiling::LatencyHistogram;
+using map_processing::socket_utils::SocketAddress;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    struct Connection {
+        int fd = -1;
+        size_t sent = 0;
+        size_t answered = 0;
+        std::string output;
+        size_t output_sent = 0;
+        // when each answer still expected was queued
+        std::deque<Clock::time_point> in_flight;
+    };
+
+    // keeps `pipeline` commands in flight on each of its connections until every one got `requests` answers
+    bool drive(std::vector<Connection> &connections, const std::vector<std::string> &commands, size_t requests,
+               size_t pipeline, LatencyHistogram &latencies) {
+        std::vector<pollfd> waits(connections.size());
+        char chunk[1 << 16];
+        size_t finished = 0;
+        while (finished < connections.size()) {
+            for (size_t c = 0; c < connections.size(); c++) {
+                Connection &connection = connections[c];
+                while (connection.in_flight.size() < pipeline && connection.sent < requests) {
+                    connection.output += commands[connection.sent++ % commands.size()];
+                    connection.output += '\n';
+                    connection.in_flight.push_back(Clock::now());
+                }
+                while (connection.output_sent < connection.output.size()) {
+                    ssize_t put = send(connection.fd, connection.output.data() + connection.output_sent,
+                                       connection.output.size() - connection.output_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+                    if (put <= 0) {
+                        if (put < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                            return false;
+                        }
+                        break;
+                    }
+                    connection.output_sent += size_t(put);
+                }
+                if (connection.output_sent == connection.output.size()) {
+                    connection.output.clear();
+                    connection.output_sent = 0;
+                }
+                bool done = connection.answered == requests;
+                waits[c] = {done ? -1 : connection.fd,
+                            static_cast<short>(POLLIN | (connection.output.empty() ? 0 : POLLOUT)), 0};
+            }
+            if (poll(waits.data(), waits.size(), -1) < 0 && errno != EINTR) {
+                return false;
+            }
+            for (size_t c = 0; c < connections.size(); c++) {
+                Connection &connection = connections[c];
+                if (!(waits[c].revents & (POLLIN | POLLHUP | POLLERR))) {
+                    continue;
+                }
+                ssize_t got = recv(connection.fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+                if (got <= 0) {
+                    if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                        return false;
+                    }
+                    continue;
+                }
+                auto now = Clock::now();
+                for (const char *end = chunk + got, *zero = chunk;
+                     (zero = static_cast<const char *>(memchr(zero, '\0', size_t(end - zero)))) != nullptr; zero++) {
+                    if (connection.in_flight.empty()) {
+                        return false;
+                    }
+                    latencies.record(static_cast<uint64_t>(
+                            std::chrono::duration_cast<std::chrono::nanoseconds>(now - connection.in_flight.front()).count()));
+                    connection.in_flight.pop_front();
+                    if (++connection.answered == requests) {
+                        finished++;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+}
+
+// usage: query_load [--connections=<n>] [--requests=<per connection>] [--pipeline=<depth>] [--threads=<n>]
+//                   [--command=<command>]... <address>, address as for test_task --serve
+int main(int argc, char *argv[]) {
+    size_t connection_count = 64;
+    size_t requests = 10000;
+    size_t pipeline = 8;
+    size_t thread_count = std::max<unsigned>(std::thread::hardware_concurrency(), 1);
+    std::vector<std::string> commands;
+    std::string address;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--connections=", 0) == 0) {
+            connection_count = std::max<size_t>(std::strtoul(arg.c_str() + 14, nullptr, 10), 1);
+        } else if (arg.rfind("--requests=", 0) == 0) {
+            requests = std::max<size_t>(std::strtoul(arg.c_str() + 11, nullptr, 10), 1);
+        } else if (arg.rfind("--pipeline=", 0) == 0) {
+            pipeline = std::max<size_t>(std::strtoul(arg.c_str() + 11, nullptr, 10), 1);
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            thread_count = std::max<size_t>(std::strtoul(arg.c_str() + 10, nullptr, 10), 1);
+        } else if (arg.rfind("--command=", 0) == 0) {
+            commands.push_back(arg.substr(10));
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "UNKNOWN OPTION " << arg << std::endl;
+            return 1;
+        } else {
+            address = arg;
+        }
+    }
+    if (address.empty()) {
+        std::cerr << "TRY *./query_load [--connections=<n>] [--requests=<n>] [--pipeline=<n>] [--threads=<n>] "
+                     "[--command=<command>]... <unix:path|[host:]port>*" << std::endl;
+        return 1;
+    }
+    if (commands.empty()) {
+        commands = {"SELECT HOUSE 0", "SELECT STATION 0", "HOUSEREL 1", "NEAREST 10 10 3"};
+    }
+    thread_count = std::min(thread_count, connection_count);
+
+    std::vector<std::vector<Connection>> groups(thread_count);
+    try {
+        SocketAddress socket_address(address);
+        for (size_t c = 0; c < connection_count; c++) {
+            groups[c % thread_count].emplace_back();
+            groups[c % thread_count].back().fd = map_processing::socket_utils::connect_socket(socket_address);
+        }
+    } catch (const map_processing::ProcessingException &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    LatencyHistogram latencies;
+    std::atomic<bool> failed{false};
+    auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (auto &group: groups) {
+        workers.emplace_back([&] {
+            if (!drive(group, commands, requests, pipeline, latencies)) {
+                failed = true;
+            }
+        });
+    }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    for (auto &group: groups) {
+        for (auto &connection: group) {
+            close(connection.fd);
+        }
+    }
+    if (failed) {
+        std::cerr << "A connection failed or was closed by the server" << std::endl;
+        return 1;
+    }
+
+    auto micros = [&latencies](double q) { return double(latencies.percentile(q)) / 1000.0; };
+    std::cout << "connections,pipeline,requests,seconds,qps,p50_us,p90_us,p99_us,p999_us,max_us\n"
+              << connection_count << ',' << pipeline << ',' << latencies.count() << ',' << elapsed.count() << ','
+              << double(latencies.count()) / elapsed.count() << ',' << micros(0.5) << ',' << micros(0.9) << ','
+              << micros(0.99) << ',' << micros(0.999) << ',' << micros(1.0) << std::endl;
+}
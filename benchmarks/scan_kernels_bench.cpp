@@ -0,0 +1,92 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include "map_processing.h"
+
+using namespace map_processing;
+using processing_types::HouseStationMap;
+using processing_types::HouseStationSet;
+using processing_core::HousesStationTracer;
+
+namespace {
+    // houses are dropped into 16x16 blocks with the given probability, every other block may get a station
+    HouseStationMap make_map(uint32_t x_size, uint32_t y_size, double house_probability, uint32_t seed) {
+        HouseStationMap map(x_size, y_size);
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<double> chance(0, 1);
+        std::uniform_int_distribution<uint32_t> side(2, 12);
+        uint8_t *cells = map.data();
+        for (uint32_t by = 0; by + 16 <= y_size; by += 16) {
+            for (uint32_t bx = 0; bx + 16 <= x_size; bx += 16) {
+                if (chance(rng) < house_probability) {
+                    uint32_t w = side(rng), h = side(rng);
+                    for (uint32_t y = by + 1; y < by + 1 + h; y++) {
+                        std::fill_n(cells + size_t(y) * x_size + bx + 1, w, 1);
+                    }
+                } else if (chance(rng) < 0.5) {
+                    cells[size_t(by + 8) * x_size + bx + 8] = 2;
+                }
+            }
+        }
+        return map;
+    }
+
+    template<typename Body>
+    double best_of(int repeats, Body body) {
+        double best = 1e300;
+        for (int r = 0; r < repeats; r++) {
+            auto start = std::chrono::steady_clock::now();
+            body();
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        return best;
+    }
+
+    // walks every non-empty run of the map with the active kernel
+    size_t count_runs(const HouseStationMap &map) {
+        size_t runs = 0;
+        for (uint32_t y = 0; y < map.y_size; y++) {
+            const uint8_t *row = map.row(y);
+            size_t x = scan_kernels::find_not_equal(row, 0, map.x_size, 0);
+            while (x < map.x_size) {
+                runs++;
+                x = scan_kernels::find_equal(row, x, map.x_size, 0);
+                x = scan_kernels::find_not_equal(row, x, map.x_size, 0);
+            }
+        }
+        return runs;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t side = argc > 1 ? static_cast<uint32_t>(std::atoi(argv[1])) : 4096;
+    const int repeats = 5;
+    struct Case {
+        const char *name;
+        double house_probability;
+    };
+    std::cout << std::left << std::setw(8) << "map" << std::setw(8) << "kernel" << std::setw(12) << "scan_ms"
+              << std::setw(12) << "trace_ms" << std::setw(10) << "speedup" << "houses" << std::endl;
+    for (Case c: {Case{"sparse", 0.02}, Case{"dense", 0.8}}) {
+        HouseStationMap map = make_map(side, side, c.house_probability, 42);
+        double scalar_trace_ms = 0;
+        for (const auto *kernel: scan_kernels::available_kernels()) {
+            scan_kernels::active_kernel() = kernel;
+            size_t runs = 0;
+            double scan_ms = best_of(repeats, [&] { runs = count_runs(map); });
+            HouseStationSet hs_set;
+            double trace_ms = best_of(repeats, [&] {
+                hs_set = HouseStationSet();
+                HousesStationTracer::trace_rows(map, 0, map.y_size, hs_set);
+            });
+            if (kernel == &scan_kernels::scalar_kernel) {
+                scalar_trace_ms = trace_ms;
+            }
+            std::cout << std::left << std::setw(8) << c.name << std::setw(8) << kernel->name << std::setw(12)
+                      << scan_ms << std::setw(12) << trace_ms << std::setw(10) << scalar_trace_ms / trace_ms
+                      << hs_set.houses.size() << " (" << runs << " runs)" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,5407 @@
+#ifndef TEST_TASK_MAP_PROCESSING_H
+#define TEST_TASK_MAP_PROCESSING_H
+
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <unordered_map>
+#include <list>
+#include <array>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <map>
+#include <queue>
+#include <string_view>
+#include <charconv>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cxxabi.h>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MAP_PROCESSING_X86_KERNELS
+#endif
+
+namespace map_processing {
+    using namespace std;
+
+    class ProcessingDataTypeMissmatch : public exception {
+    public:
+        explicit ProcessingDataTypeMissmatch(const char *message_) {
+            this->message = message_;
+        }
+
+        [[nodiscard]] const char *what() const noexcept override {
+            return this->message;
+        }
+
+    private:
+        const char *message;
+    };
+
+    class ProcessingException : public exception {
+    public:
+        explicit ProcessingException(const char *message_) {
+            this->message = message_;
+        }
+
+        [[nodiscard]] const char *what() const noexcept override {
+            return message;
+        }
+
+    private:
+        const char *message;
+    };
+
+    class ProcessingData {
+    public:
+        virtual ~ProcessingData() = default;
+    };
+
+    class DataProcessor {
+    public:
+        DataProcessor() = default;
+
+        virtual shared_ptr<ProcessingData> process(shared_ptr<ProcessingData>) = 0;
+
+        virtual ~DataProcessor() = default;
+    };
+
+    class FinalProcessingUnit {
+    public:
+        virtual void process(shared_ptr<ProcessingData>) = 0;
+
+        virtual ~FinalProcessingUnit() = default;
+    };
+
+    namespace string_utils {
+        inline void strip(string &str) {
+            if ((int) str.length() != 0) {
+                auto w = string(" ");
+                auto n = string("\n");
+                auto r = string("\t");
+                auto t = string("\r");
+                auto v = string(1, str.front());
+                while ((v == w) || (v == t) || (v == r) || (v == n)) {
+                    str.erase(str.begin());
+                    if (str.empty()) {
+                        return;
+                    }
+                    v = string(1, str.front());
+                }
+                v = string(1, str.back());
+                while ((v == w) || (v == t) || (v == r) || (v == n)) {
+                    str.erase(str.end() - 1);
+                    v = string(1, str.back());
+                }
+            }
+        }
+    }
+
+    namespace output_utils {
+        // where BufferedWriter puts its full buffers
+        class OutputSink {
+        public:
+            virtual void write(const char *data, size_t size) = 0;
+
+            virtual ~OutputSink() = default;
+        };
+
+        class StreamSink : public OutputSink {
+        public:
+            explicit StreamSink(ostream &stream) : stream(stream) {}
+
+            void write(const char *data, size_t size) override {
+                stream.write(data, static_cast<streamsize>(size));
+                stream.flush();
+            }
+
+        private:
+            ostream &stream;
+        };
+
+        class StringSink : public OutputSink {
+        public:
+            void write(const char *data, size_t size) override {
+                text.append(data, size);
+            }
+
+            string text;
+        };
+
+        // formats records straight into a fixed buffer (to_chars, no temporaries) and hands it to the sink
+        // whenever it fills up, so long answers start flowing before they are complete
+        class BufferedWriter {
+        public:
+            explicit BufferedWriter(OutputSink &sink, size_t capacity = size_t(1) << 16)
+                    : sink(sink), buffer(max<size_t>(capacity, 64)) {}
+
+            BufferedWriter(const BufferedWriter &) = delete;
+
+            BufferedWriter &operator=(const BufferedWriter &) = delete;
+
+            ~BufferedWriter() {
+                flush();
+            }
+
+            BufferedWriter &operator<<(string_view text) {
+                while (!text.empty()) {
+                    if (used == buffer.size()) {
+                        flush();
+                    }
+                    size_t chunk = min(text.size(), buffer.size() - used);
+                    memcpy(buffer.data() + used, text.data(), chunk);
+                    used += chunk;
+                    text.remove_prefix(chunk);
+                }
+                return *this;
+            }
+
+            BufferedWriter &operator<<(const char *text) {
+                return *this << string_view(text);
+            }
+
+            BufferedWriter &operator<<(char c) {
+                if (used == buffer.size()) {
+                    flush();
+                }
+                buffer[used++] = c;
+                return *this;
+            }
+
+            template<typename Integer, typename = enable_if_t<is_integral_v<Integer>>>
+            BufferedWriter &operator<<(Integer value) {
+                reserve(24);
+                used = static_cast<size_t>(to_chars(buffer.data() + used, buffer.data() + buffer.size(), value).ptr -
+                                           buffer.data());
+                return *this;
+            }
+
+            // same digits as to_string(float)
+            BufferedWriter &operator<<(float value) {
+                reserve(64);
+                auto result = to_chars(buffer.data() + used, buffer.data() + buffer.size(), value,
+                                       chars_format::fixed, 6);
+                if (result.ec != errc()) {
+                    return *this << to_string(value);
+                }
+                used = static_cast<size_t>(result.ptr - buffer.data());
+                return *this;
+            }
+
+            void flush() {
+                if (used != 0) {
+                    sink.write(buffer.data(), used);
+                    used = 0;
+                }
+            }
+
+        private:
+            void reserve(size_t size) {
+                if (buffer.size() - used < size) {
+                    flush();
+                }
+            }
+
+            OutputSink &sink;
+            vector<char> buffer;
+            size_t used = 0;
+        };
+    }
+
+    namespace math_utils {
+        // exact for coordinates below 2^31, which keeps the sum below 2^63
+        inline uint64_t squared_distance(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2) {
+            const int64_t dx = int64_t(x2) - int64_t(x1);
+            const int64_t dy = int64_t(y2) - int64_t(y1);
+            return uint64_t(dx * dx) + uint64_t(dy * dy);
+        }
+
+        inline auto distance_func = [](uint32_t x1, uint32_t y1, uint32_t x2, u_int32_t y2) {
+            return (float) sqrt(double(squared_distance(x1, y1, x2, y2)));
+        };
+    }
+
+    namespace concurrency_utils {
+        class ThreadPool {
+        public:
+            explicit ThreadPool(size_t thread_count = default_thread_count()) {
+                thread_count = max<size_t>(thread_count, 1);
+                for (size_t i = 0; i < thread_count; i++) {
+                    workers.emplace_back([this] { work(); });
+                }
+            }
+
+            ThreadPool(const ThreadPool &) = delete;
+
+            ThreadPool &operator=(const ThreadPool &) = delete;
+
+            ~ThreadPool() {
+                {
+                    lock_guard<mutex> lock(tasks_mutex);
+                    stopping = true;
+                }
+                tasks_cv.notify_all();
+                for (auto &worker: workers) {
+                    worker.join();
+                }
+            }
+
+            template<typename Task>
+            auto submit(Task &&task) -> future<invoke_result_t<Task>> {
+                auto packaged = make_shared<packaged_task<invoke_result_t<Task>()>>(std::forward<Task>(task));
+                auto result = packaged->get_future();
+                {
+                    lock_guard<mutex> lock(tasks_mutex);
+                    tasks.emplace([packaged] { (*packaged)(); });
+                }
+                tasks_cv.notify_one();
+                return result;
+            }
+
+            [[nodiscard]] size_t size() const {
+                return workers.size();
+            }
+
+            static size_t default_thread_count() {
+                return max<size_t>(thread::hardware_concurrency(), 1);
+            }
+
+        private:
+            void work() {
+                while (true) {
+                    function<void()> task;
+                    {
+                        unique_lock<mutex> lock(tasks_mutex);
+                        tasks_cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+                        if (tasks.empty()) {
+                            return;
+                        }
+                        task = std::move(tasks.front());
+                        tasks.pop();
+                    }
+                    task();
+                }
+            }
+
+            vector<thread> workers;
+            queue<function<void()>> tasks;
+            mutex tasks_mutex;
+            condition_variable tasks_cv;
+            bool stopping = false;
+        };
+
+        struct QueueStats {
+            size_t capacity = 0;
+            size_t pushes = 0;
+            // sum of the occupancy seen by every push, divide by pushes for the average
+            size_t occupancy_sum = 0;
+            // times the producer found the queue full / the consumer found it empty
+            size_t full_waits = 0;
+            size_t empty_waits = 0;
+        };
+
+        // bounded lock-free queue for exactly one producer thread and one consumer thread; push waits while the
+        // queue is full, which is what holds a fast stage back to the pace of a slow one. A waiting side spins
+        // briefly, then sleeps until the other side wakes it
+        template<typename T>
+        class SpscQueue {
+        public:
+            explicit SpscQueue(size_t capacity) : slots(capacity + 1) {}
+
+            SpscQueue(const SpscQueue &) = delete;
+
+            SpscQueue &operator=(const SpscQueue &) = delete;
+
+            void push(T value) {
+                const size_t tail = write_index.load(memory_order_relaxed);
+                const size_t next = advance(tail);
+                if (next == read_index.load(memory_order_acquire)) {
+                    full_waits++;
+                    wait_until([&] { return next != read_index.load(memory_order_acquire); });
+                }
+                occupancy_sum += (tail + slots.size() - read_index.load(memory_order_acquire)) % slots.size();
+                pushes++;
+                slots[tail] = std::move(value);
+                write_index.store(next, memory_order_release);
+                wake();
+            }
+
+            // no more pushes after this one
+            void close() {
+                closed.store(true, memory_order_release);
+                wake();
+            }
+
+            // false once the queue is closed and drained
+            bool pop(T &value) {
+                const size_t head = read_index.load(memory_order_relaxed);
+                if (head == write_index.load(memory_order_acquire)) {
+                    empty_waits++;
+                    wait_until([&] {
+                        return head != write_index.load(memory_order_acquire) || closed.load(memory_order_acquire);
+                    });
+                    if (head == write_index.load(memory_order_acquire)) {
+                        return false;
+                    }
+                }
+                value = std::move(slots[head]);
+                read_index.store(advance(head), memory_order_release);
+                wake();
+                return true;
+            }
+
+            // only meaningful once both sides are done
+            [[nodiscard]] QueueStats stats() const {
+                return {slots.size() - 1, pushes, occupancy_sum, full_waits, empty_waits};
+            }
+
+        private:
+            [[nodiscard]] size_t advance(size_t index) const {
+                return index + 1 == slots.size() ? 0 : index + 1;
+            }
+
+            // only one side waits at a time: the queue can not be full and empty at once
+            template<typename Ready>
+            void wait_until(Ready ready) {
+                for (int spin = 0; spin < 64; spin++) {
+                    if (ready()) {
+                        return;
+                    }
+                    this_thread::yield();
+                }
+                unique_lock<mutex> lock(wait_mutex);
+                sleeping.store(true, memory_order_relaxed);
+                // pairs with the fence in wake(): either the waker sees `sleeping` or this side sees its update
+                atomic_thread_fence(memory_order_seq_cst);
+                wake_cv.wait(lock, ready);
+                sleeping.store(false, memory_order_relaxed);
+            }
+
+            void wake() {
+                atomic_thread_fence(memory_order_seq_cst);
+                if (sleeping.load(memory_order_relaxed)) {
+                    lock_guard<mutex> lock(wait_mutex);
+                    wake_cv.notify_one();
+                }
+            }
+
+            vector<T> slots;
+            alignas(64) atomic<size_t> write_index{0};
+            alignas(64) atomic<size_t> read_index{0};
+            atomic<bool> closed{false};
+            atomic<bool> sleeping{false};
+            mutex wait_mutex;
+            condition_variable wake_cv;
+            // producer side
+            alignas(64) size_t pushes = 0;
+            size_t occupancy_sum = 0;
+            size_t full_waits = 0;
+            // consumer side
+            alignas(64) size_t empty_waits = 0;
+        };
+    }
+
+    namespace socket_utils {
+        // "unix:<path>" for a Unix domain socket, "<port>" or "<ipv4 host>:<port>" for TCP (127.0.0.1 by default)
+        struct SocketAddress {
+            sockaddr_storage storage{};
+            socklen_t length = 0;
+
+            explicit SocketAddress(const string &address) {
+                if (address.rfind("unix:", 0) == 0) {
+                    auto *unix_address = reinterpret_cast<sockaddr_un *>(&storage);
+                    string path = address.substr(5);
+                    if (path.empty() || path.size() >= sizeof(unix_address->sun_path)) {
+                        throw ProcessingException("Invalid Unix socket path!");
+                    }
+                    unix_address->sun_family = AF_UNIX;
+                    memcpy(unix_address->sun_path, path.c_str(), path.size() + 1);
+                    length = sizeof(sockaddr_un);
+                    return;
+                }
+                size_t colon = address.rfind(':');
+                string host = colon == string::npos ? "127.0.0.1" : address.substr(0, colon);
+                string port = colon == string::npos ? address : address.substr(colon + 1);
+                auto *inet_address = reinterpret_cast<sockaddr_in *>(&storage);
+                inet_address->sin_family = AF_INET;
+                char *rest = nullptr;
+                unsigned long port_number = strtoul(port.c_str(), &rest, 10);
+                if (port.empty() || *rest != '\0' || port_number > 65535 ||
+                    inet_pton(AF_INET, host.c_str(), &inet_address->sin_addr) != 1) {
+                    throw ProcessingException("Invalid socket address, expected unix:<path>, <port> or <host>:<port>!");
+                }
+                inet_address->sin_port = htons(static_cast<uint16_t>(port_number));
+                length = sizeof(sockaddr_in);
+            }
+
+            [[nodiscard]] int family() const {
+                return storage.ss_family;
+            }
+
+            [[nodiscard]] const sockaddr *get() const {
+                return reinterpret_cast<const sockaddr *>(&storage);
+            }
+        };
+
+        // non-blocking listening socket; a stale Unix socket file is replaced
+        inline int listen_socket(const SocketAddress &address) {
+            int fd = socket(address.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                throw ProcessingException("Can not create the socket!");
+            }
+            if (address.family() == AF_UNIX) {
+                unlink(reinterpret_cast<const sockaddr_un *>(&address.storage)->sun_path);
+            } else {
+                int on = 1;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            }
+            if (bind(fd, address.get(), address.length) != 0 || listen(fd, SOMAXCONN) != 0) {
+                close(fd);
+                throw ProcessingException("Can not listen on the socket address!");
+            }
+            return fd;
+        }
+
+        // blocking connected socket, TCP without Nagle since requests are small
+        inline int connect_socket(const SocketAddress &address) {
+            int fd = socket(address.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                throw ProcessingException("Can not create the socket!");
+            }
+            if (connect(fd, address.get(), address.length) != 0) {
+                close(fd);
+                throw ProcessingException("Can not connect to the socket address!");
+            }
+            if (address.family() != AF_UNIX) {
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+            return fd;
+        }
+
+        // what the socket is bound to, with the port the kernel picked for port 0
+        inline string local_address(int fd) {
+            sockaddr_storage storage{};
+            socklen_t length = sizeof(storage);
+            getsockname(fd, reinterpret_cast<sockaddr *>(&storage), &length);
+            if (storage.ss_family == AF_UNIX) {
+                return string("unix:") + reinterpret_cast<const sockaddr_un *>(&storage)->sun_path;
+            }
+            const auto *inet_address = reinterpret_cast<const sockaddr_in *>(&storage);
+            char host[INET_ADDRSTRLEN] = {};
+            inet_ntop(AF_INET, &inet_address->sin_addr, host, sizeof(host));
+            return string(host) + ":" + to_string(ntohs(inet_address->sin_port));
+        }
+    }
+
+    namespace profiling {
+        using output_utils::BufferedWriter;
+
+        // log-scale latency buckets, four per power of two nanoseconds, so percentiles are within about 20%
+        class LatencyHistogram {
+        public:
+            void record(uint64_t nanoseconds) {
+                buckets[bucket_of(nanoseconds)].fetch_add(1, memory_order_relaxed);
+                total.fetch_add(1, memory_order_relaxed);
+            }
+
+            [[nodiscard]] uint64_t count() const {
+                return total.load(memory_order_relaxed);
+            }
+
+            // lower edge of the bucket holding the q-th quantile, in nanoseconds
+            [[nodiscard]] uint64_t percentile(double q) const {
+                uint64_t target = static_cast<uint64_t>(ceil(q * double(count())));
+                uint64_t seen = 0;
+                for (size_t i = 0; i < bucket_count; i++) {
+                    seen += buckets[i].load(memory_order_relaxed);
+                    if (seen >= target && seen != 0) {
+                        return lower_edge(i);
+                    }
+                }
+                return 0;
+            }
+
+        private:
+            static constexpr size_t bucket_count = 256;
+
+            static size_t bucket_of(uint64_t value) {
+                if (value < 4) {
+                    return size_t(value);
+                }
+                size_t msb = 63 - size_t(__builtin_clzll(value));
+                return min(msb * 4 + size_t((value >> (msb - 2)) & 3), bucket_count - 1);
+            }
+
+            static uint64_t lower_edge(size_t bucket) {
+                if (bucket < 4) {
+                    return bucket;
+                }
+                size_t msb = bucket / 4;
+                return (uint64_t(1) << msb) | (uint64_t(bucket % 4) << (msb - 2));
+            }
+
+            atomic<uint64_t> buckets[bucket_count] = {};
+            atomic<uint64_t> total{0};
+        };
+
+        inline double cpu_time_ms() {
+            timespec time{};
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+            return double(time.tv_sec) * 1e3 + double(time.tv_nsec) / 1e6;
+        }
+
+        inline uint64_t peak_rss_kib() {
+            rusage usage{};
+            getrusage(RUSAGE_SELF, &usage);
+            return static_cast<uint64_t>(usage.ru_maxrss);
+        }
+
+        // class name of a processor without its namespaces
+        inline string type_name(const type_info &type) {
+            int status = 0;
+            char *demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+            string name = status == 0 ? demangled : type.name();
+            free(demangled);
+            size_t template_start = name.find('<');
+            size_t last_scope = name.rfind("::", template_start);
+            return last_scope == string::npos ? name : name.substr(last_scope + 2);
+        }
+
+        // counters of one run; stages are recorded by the pipeline thread, everything else may be hit concurrently
+        class Profiler {
+        public:
+            struct Stage {
+                string name;
+                double wall_ms;
+                // CPU time of the whole process, more than wall_ms for stages that run threads
+                double cpu_ms;
+            };
+
+            // times the stage body and records it under name
+            template<typename Body>
+            auto time_stage(string name, Body body) {
+                auto wall_start = chrono::steady_clock::now();
+                double cpu_start = cpu_time_ms();
+                auto record = [&] {
+                    chrono::duration<double, milli> wall = chrono::steady_clock::now() - wall_start;
+                    lock_guard<mutex> lock(stages_mutex);
+                    stages.push_back({std::move(name), wall.count(), cpu_time_ms() - cpu_start});
+                };
+                if constexpr (is_void_v<invoke_result_t<Body>>) {
+                    body();
+                    record();
+                } else {
+                    auto result = body();
+                    record();
+                    return result;
+                }
+            }
+
+            LatencyHistogram &command_histogram(const string &command) {
+                {
+                    shared_lock<shared_mutex> lock(commands_mutex);
+                    auto it = commands.find(command);
+                    if (it != commands.end()) {
+                        return *it->second;
+                    }
+                }
+                unique_lock<shared_mutex> lock(commands_mutex);
+                auto &histogram = commands[command];
+                if (!histogram) {
+                    histogram = make_unique<LatencyHistogram>();
+                }
+                return *histogram;
+            }
+
+            void record_table(size_t houses, size_t stations) {
+                house_count = houses;
+                station_count = stations;
+            }
+
+            void write_report(BufferedWriter &out) {
+                out << "STAGES:\n";
+                for (const auto &stage: stage_list()) {
+                    out << '\t' << stage.name << ": WALL " << float(stage.wall_ms) << " ms, CPU "
+                        << float(stage.cpu_ms) << " ms\n";
+                }
+                out << "BYTES READ: " << bytes_read.load() << '\n';
+                out << "HOUSES: " << house_count.load() << ", STATIONS: " << station_count.load() << '\n';
+                out << "PEAK RSS: " << peak_rss_kib() << " KiB\n";
+                out << "COMMANDS:\n";
+                for_each_command([&out](const string &name, const LatencyHistogram &histogram) {
+                    out << '\t' << name << ": " << histogram.count() << " CALLS, P50 "
+                        << float(histogram.percentile(0.5)) / 1e3f << " us, P99 "
+                        << float(histogram.percentile(0.99)) / 1e3f << " us\n";
+                });
+                uint64_t hits = result_cache_hits.load(), misses = result_cache_misses.load();
+                out << "TILES: " << tile_pieces_stitched.load() << " HOUSE PIECES STITCHED, "
+                    << tile_houses_beyond_halo.load() << " HOUSES ASSIGNED BEYOND THEIR HALO\n";
+                out << "RESULT CACHE: " << hits << " HITS, " << misses << " MISSES, HIT RATE "
+                    << (hits + misses == 0 ? 0.0f : float(hits) / float(hits + misses));
+            }
+
+            void write_json(BufferedWriter &out) {
+                out << "{\"stages\":[";
+                const char *separator = "";
+                for (const auto &stage: stage_list()) {
+                    out << separator << "{\"name\":\"" << stage.name << "\",\"wall_ms\":" << float(stage.wall_ms)
+                        << ",\"cpu_ms\":" << float(stage.cpu_ms) << '}';
+                    separator = ",";
+                }
+                out << "],\"bytes_read\":" << bytes_read.load() << ",\"houses\":" << house_count.load()
+                    << ",\"stations\":" << station_count.load() << ",\"peak_rss_kib\":" << peak_rss_kib()
+                    << ",\"commands\":{";
+                separator = "";
+                for_each_command([&](const string &name, const LatencyHistogram &histogram) {
+                    out << separator << '"' << name << "\":{\"count\":" << histogram.count() << ",\"p50_ns\":"
+                        << histogram.percentile(0.5) << ",\"p99_ns\":" << histogram.percentile(0.99) << '}';
+                    separator = ",";
+                });
+                out << "},\"tiles\":{\"pieces_stitched\":" << tile_pieces_stitched.load()
+                    << ",\"houses_beyond_halo\":" << tile_houses_beyond_halo.load() << "},\"result_cache\":{\"hits\":"
+                    << result_cache_hits.load() << ",\"misses\":" << result_cache_misses.load() << "}}\n";
+            }
+
+            atomic<uint64_t> bytes_read{0};
+            atomic<uint64_t> result_cache_hits{0};
+            atomic<uint64_t> result_cache_misses{0};
+            // filled by TiledMapProcessor, both stay 0 for single files
+            atomic<uint64_t> tile_pieces_stitched{0};
+            atomic<uint64_t> tile_houses_beyond_halo{0};
+
+        private:
+            vector<Stage> stage_list() {
+                lock_guard<mutex> lock(stages_mutex);
+                return stages;
+            }
+
+            template<typename Visitor>
+            void for_each_command(Visitor visit) {
+                shared_lock<shared_mutex> lock(commands_mutex);
+                for (const auto &command: commands) {
+                    visit(command.first, *command.second);
+                }
+            }
+
+            vector<Stage> stages;
+            mutex stages_mutex;
+            // ordered so reports list the commands alphabetically
+            map<string, unique_ptr<LatencyHistogram>> commands;
+            shared_mutex commands_mutex;
+            atomic<size_t> house_count{0};
+            atomic<size_t> station_count{0};
+        };
+
+        // nullptr unless profiling was switched on; instrumented code checks it and does nothing else when off
+        inline Profiler *&active_profiler() {
+            static Profiler *profiler = nullptr;
+            return profiler;
+        }
+
+        inline void count_bytes_read(size_t bytes) {
+            if (auto *profiler = active_profiler()) {
+                profiler->bytes_read.fetch_add(bytes, memory_order_relaxed);
+            }
+        }
+    }
+
+    namespace scan_kernels {
+        // all finders return the first index in [from, size) where the byte is (or is not) `value`, or size
+        using FindFunction = size_t (*)(const uint8_t *, size_t, size_t, uint8_t);
+
+        struct ScanKernel {
+            const char *name;
+            FindFunction find_equal;
+            FindFunction find_not_equal;
+        };
+
+        template<bool Equal>
+        size_t find_scalar(const uint8_t *data, size_t from, size_t size, uint8_t value) {
+            for (size_t i = from; i < size; i++) {
+                if ((data[i] == value) == Equal) {
+                    return i;
+                }
+            }
+            return size;
+        }
+
+#ifdef MAP_PROCESSING_X86_KERNELS
+        template<bool Equal>
+        size_t find_sse2(const uint8_t *data, size_t from, size_t size, uint8_t value) {
+            const __m128i pattern = _mm_set1_epi8(static_cast<char>(value));
+            size_t i = from;
+            for (; i + 16 <= size; i += 16) {
+                auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+                unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern)));
+                if (!Equal) {
+                    mask ^= 0xFFFFu;
+                }
+                if (mask != 0) {
+                    return i + static_cast<size_t>(__builtin_ctz(mask));
+                }
+            }
+            return find_scalar<Equal>(data, i, size, value);
+        }
+
+        template<bool Equal>
+        __attribute__((target("avx2")))
+        size_t find_avx2(const uint8_t *data, size_t from, size_t size, uint8_t value) {
+            const __m256i pattern = _mm256_set1_epi8(static_cast<char>(value));
+            size_t i = from;
+            for (; i + 32 <= size; i += 32) {
+                auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+                auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, pattern)));
+                if (!Equal) {
+                    mask = ~mask;
+                }
+                if (mask != 0) {
+                    return i + static_cast<size_t>(__builtin_ctz(mask));
+                }
+            }
+            return find_sse2<Equal>(data, i, size, value);
+        }
+#endif
+
+        inline const ScanKernel scalar_kernel = {"scalar", &find_scalar<true>, &find_scalar<false>};
+#ifdef MAP_PROCESSING_X86_KERNELS
+        inline const ScanKernel sse2_kernel = {"sse2", &find_sse2<true>, &find_sse2<false>};
+        inline const ScanKernel avx2_kernel = {"avx2", &find_avx2<true>, &find_avx2<false>};
+#endif
+
+        // kernels the running cpu can execute, best last
+        inline vector<const ScanKernel *> available_kernels() {
+            vector<const ScanKernel *> kernels = {&scalar_kernel};
+#ifdef MAP_PROCESSING_X86_KERNELS
+            kernels.push_back(&sse2_kernel);
+            if (__builtin_cpu_supports("avx2")) {
+                kernels.push_back(&avx2_kernel);
+            }
+#endif
+            return kernels;
+        }
+
+        // kernel used by the tracers, can be replaced e.g. for benchmarking
+        inline const ScanKernel *&active_kernel() {
+            static const ScanKernel *kernel = available_kernels().back();
+            return kernel;
+        }
+
+        inline size_t find_equal(const uint8_t *data, size_t from, size_t size, uint8_t value) {
+            return from >= size ? size : active_kernel()->find_equal(data, from, size, value);
+        }
+
+        inline size_t find_not_equal(const uint8_t *data, size_t from, size_t size, uint8_t value) {
+            return from >= size ? size : active_kernel()->find_not_equal(data, from, size, value);
+        }
+    }
+
+    namespace processing_types {
+        using math_utils::distance_func;
+        using output_utils::BufferedWriter;
+
+        class TextData : public ProcessingData {
+        public:
+            string text;
+        };
+
+        // contiguous row-major cells, either owned or pointing into memory kept alive by `backing`
+        class HouseStationMap : public ProcessingData {
+        public:
+            HouseStationMap(uint32_t x_size, uint32_t y_size)
+                    : x_size(x_size), y_size(y_size), stride(x_size), storage(size_t(x_size) * y_size),
+                      cells(storage.data()) {}
+
+            HouseStationMap(uint32_t x_size, uint32_t y_size, const uint8_t *cells, shared_ptr<const void> backing)
+                    : x_size(x_size), y_size(y_size), stride(x_size), cells(cells), backing(std::move(backing)) {}
+
+            HouseStationMap(const HouseStationMap &) = delete;
+
+            HouseStationMap &operator=(const HouseStationMap &) = delete;
+
+            HouseStationMap(HouseStationMap &&) = default;
+
+            HouseStationMap &operator=(HouseStationMap &&) = default;
+
+            [[nodiscard]] const uint8_t *row(uint32_t y) const {
+                return cells + size_t(y) * stride;
+            }
+
+            // writable cells, only for maps that own their storage
+            uint8_t *data() {
+                return storage.data();
+            }
+
+            uint32_t x_size;
+            uint32_t y_size;
+            size_t stride;
+
+        private:
+            vector<uint8_t> storage;
+            const uint8_t *cells;
+            shared_ptr<const void> backing;
+        };
+
+        // maximal run of equal non-empty cells in a row; the length keeps the value in its top bit
+        struct CellRun {
+            uint32_t x;
+            uint32_t length_and_value;
+
+            static constexpr uint32_t station_bit = uint32_t(1) << 31;
+
+            static CellRun make(uint32_t x, uint32_t length, uint8_t value) {
+                return {x, length | (value == 2 ? station_bit : 0)};
+            }
+
+            [[nodiscard]] uint32_t length() const {
+                return length_and_value & ~station_bit;
+            }
+
+            [[nodiscard]] uint32_t end() const {
+                return x + length();
+            }
+
+            [[nodiscard]] uint8_t value() const {
+                return (length_and_value & station_bit) ? 2 : 1;
+            }
+        };
+
+        // the map as runs of non-empty cells per row, empty space costs nothing; row y is
+        // runs()[row_start()[y], row_start()[y + 1]). Owned or pointing into memory kept alive by `backing`
+        class RunLengthMap : public ProcessingData {
+        public:
+            RunLengthMap(uint32_t x_size, uint32_t y_size, vector<uint64_t> row_starts, vector<CellRun> cell_runs)
+                    : x_size(x_size), y_size(y_size), owned_row_starts(std::move(row_starts)),
+                      owned_runs(std::move(cell_runs)), starts(owned_row_starts.data()), run_data(owned_runs.data()) {}
+
+            RunLengthMap(uint32_t x_size, uint32_t y_size, const uint64_t *row_starts, const CellRun *cell_runs,
+                         shared_ptr<const void> backing)
+                    : x_size(x_size), y_size(y_size), starts(row_starts), run_data(cell_runs),
+                      backing(std::move(backing)) {}
+
+            RunLengthMap(const RunLengthMap &) = delete;
+
+            RunLengthMap &operator=(const RunLengthMap &) = delete;
+
+            RunLengthMap(RunLengthMap &&) = default;
+
+            RunLengthMap &operator=(RunLengthMap &&) = default;
+
+            [[nodiscard]] const CellRun *row_begin(uint32_t y) const {
+                return run_data + starts[y];
+            }
+
+            [[nodiscard]] const CellRun *row_end(uint32_t y) const {
+                return run_data + starts[y + 1];
+            }
+
+            [[nodiscard]] size_t run_count() const {
+                return y_size == 0 ? 0 : size_t(starts[y_size]);
+            }
+
+            [[nodiscard]] const uint64_t *row_starts() const {
+                return starts;
+            }
+
+            [[nodiscard]] const CellRun *runs() const {
+                return run_data;
+            }
+
+            // first run of row y that ends after x
+            [[nodiscard]] const CellRun *run_after(uint32_t y, uint32_t x) const {
+                return upper_bound(row_begin(y), row_end(y), x, [](uint32_t value, const CellRun &run) {
+                    return value < run.end();
+                });
+            }
+
+            [[nodiscard]] uint8_t cell(uint32_t x, uint32_t y) const {
+                const CellRun *run = run_after(y, x);
+                return run != row_end(y) && run->x <= x ? run->value() : 0;
+            }
+
+            // first empty cell of row y at or after x, x_size if none
+            [[nodiscard]] uint32_t find_empty(uint32_t y, uint32_t x) const {
+                const CellRun *run = run_after(y, x);
+                while (run != row_end(y) && run->x <= x) {
+                    x = run->end();
+                    run++;
+                }
+                return min(x, x_size);
+            }
+
+            // expands into one byte per cell, each run is a single fill
+            [[nodiscard]] HouseStationMap decode() const {
+                HouseStationMap hs_map(x_size, y_size);
+                uint8_t *cells = hs_map.data();
+                for (uint32_t y = 0; y < y_size; y++) {
+                    uint8_t *row = cells + size_t(y) * x_size;
+                    for (const CellRun *run = row_begin(y); run != row_end(y); run++) {
+                        memset(row + run->x, run->value(), run->length());
+                    }
+                }
+                return hs_map;
+            }
+
+            uint32_t x_size;
+            uint32_t y_size;
+
+        private:
+            vector<uint64_t> owned_row_starts;
+            vector<CellRun> owned_runs;
+            const uint64_t *starts;
+            const CellRun *run_data;
+            shared_ptr<const void> backing;
+        };
+
+
+        struct House {
+            uint32_t x_center;
+            uint32_t y_center;
+            uint32_t x_size;
+            uint32_t y_size;
+            size_t house_number;
+        };
+
+        inline string house_to_string(const House &current_house) {
+            return "HOUSE" + to_string(current_house.house_number) + ": {CORDS: {" + to_string(current_house.x_center) +
+                   ", " +
+                   to_string(current_house.y_center) + "}; SIZE: {" + to_string(current_house.x_size) + ", " +
+                   to_string(current_house.y_size) + "}}";
+        }
+
+        struct Station {
+            uint32_t x_center;
+            uint32_t y_center;
+            size_t station_number;
+        };
+
+        inline string station_to_string(const Station &current_station) {
+            return "STAT" + to_string(current_station.station_number) + ": {CORDS: {" +
+                   to_string(current_station.x_center) + ", " +
+                   to_string(current_station.y_center) + "}}";
+        }
+
+        inline void write_house(BufferedWriter &out, const House &current_house) {
+            out << "HOUSE" << current_house.house_number << ": {CORDS: {" << current_house.x_center << ", "
+                << current_house.y_center << "}; SIZE: {" << current_house.x_size << ", " << current_house.y_size << "}}";
+        }
+
+        inline void write_station(BufferedWriter &out, const Station &current_station) {
+            out << "STAT" << current_station.station_number << ": {CORDS: {" << current_station.x_center << ", "
+                << current_station.y_center << "}}";
+        }
+
+        inline float calculate_distance_between_hs(const House &h, const Station &s) {
+            return distance_func(h.x_center, h.y_center, s.x_center, s.y_center);
+        }
+
+        class HouseStationSet : public ProcessingData {
+        public:
+            HouseStationSet() = default;
+
+            uint32_t x_size = 0;
+            uint32_t y_size = 0;
+            vector<House> houses;
+            vector<Station> stations;
+        };
+
+        // index of the nearest station for every cell of the map, row-major
+        class NearestStationField {
+        public:
+            static constexpr uint32_t no_station = UINT32_MAX;
+
+            NearestStationField(uint32_t x_size, uint32_t y_size)
+                    : x_size(x_size), y_size(y_size), nearest(size_t(x_size) * y_size, no_station) {}
+
+            [[nodiscard]] uint32_t station_at(uint32_t x, uint32_t y) const {
+                return nearest[size_t(y) * x_size + x];
+            }
+
+            uint32_t x_size;
+            uint32_t y_size;
+            vector<uint32_t> nearest;
+        };
+
+        // struct-of-arrays tables indexed by house_number / station_number, plus the houses of every station in
+        // compressed sparse row form: station s owns positions [station_house_offsets[s], station_house_offsets[s + 1])
+        // of station_house_ids and station_house_distances
+        class HouseStationTable : public ProcessingData {
+        public:
+            static constexpr uint32_t no_station = UINT32_MAX;
+            // x of a removed house or station; ids stay stable, so removed entries are kept as holes
+            static constexpr uint32_t removed = UINT32_MAX;
+
+            [[nodiscard]] size_t house_count() const {
+                return house_x.size();
+            }
+
+            [[nodiscard]] size_t station_count() const {
+                return station_x.size();
+            }
+
+            [[nodiscard]] House house(size_t index) const {
+                return {house_x[index], house_y[index], house_width[index], house_height[index], index};
+            }
+
+            [[nodiscard]] Station station(size_t index) const {
+                return {station_x[index], station_y[index], index};
+            }
+
+            [[nodiscard]] bool has_house(size_t index) const {
+                return index < house_count() && house_x[index] != removed;
+            }
+
+            [[nodiscard]] bool has_station(size_t index) const {
+                return index < station_count() && station_x[index] != removed;
+            }
+
+            // rebuilds the station -> houses index from house_station
+            void index_station_houses() {
+                station_house_offsets.assign(station_count() + 1, 0);
+                for (uint32_t station: house_station) {
+                    if (station != no_station) {
+                        station_house_offsets[station + 1]++;
+                    }
+                }
+                for (size_t i = 1; i < station_house_offsets.size(); i++) {
+                    station_house_offsets[i] += station_house_offsets[i - 1];
+                }
+                station_house_ids.resize(station_house_offsets.back());
+                station_house_distances.resize(station_house_offsets.back());
+                vector<uint32_t> fill(station_house_offsets.begin(), station_house_offsets.end() - 1);
+                for (size_t h = 0; h < house_count(); h++) {
+                    uint32_t station = house_station[h];
+                    if (station == no_station) {
+                        continue;
+                    }
+                    uint32_t slot = fill[station]++;
+                    station_house_ids[slot] = static_cast<uint32_t>(h);
+                    station_house_distances[slot] = distance_func(house_x[h], house_y[h], station_x[station],
+                                                                  station_y[station]);
+                }
+            }
+
+            vector<uint32_t> house_x;
+            vector<uint32_t> house_y;
+            vector<uint32_t> house_width;
+            vector<uint32_t> house_height;
+            vector<uint32_t> house_station;
+
+            vector<uint32_t> station_x;
+            vector<uint32_t> station_y;
+
+            vector<uint32_t> station_house_offsets;
+            vector<uint32_t> station_house_ids;
+            vector<float> station_house_distances;
+
+            // only filled by StationFeatureTransform
+            shared_ptr<NearestStationField> station_field;
+        };
+    }
+
+    namespace spatial_index {
+        using math_utils::distance_func;
+        using math_utils::squared_distance;
+
+        constexpr size_t npos = static_cast<size_t>(-1);
+
+        // cell layout of a uniform bucket grid
+        struct GridGeometry {
+            uint32_t min_x = 0;
+            uint32_t min_y = 0;
+            uint32_t cell_size = 1;
+            uint32_t grid_x = 0;
+            uint32_t grid_y = 0;
+
+            [[nodiscard]] size_t cell_count() const {
+                return size_t(grid_x) * grid_y;
+            }
+
+            [[nodiscard]] size_t cell_of(uint32_t x, uint32_t y) const {
+                return size_t((y - min_y) / cell_size) * grid_x + (x - min_x) / cell_size;
+            }
+
+            [[nodiscard]] uint32_t clamp_cell(uint32_t v, uint32_t lo, uint32_t cells) const {
+                if (v < lo) {
+                    return 0;
+                }
+                return min((v - lo) / cell_size, cells - 1);
+            }
+
+            // visits cells ring by ring around the cell of (x, y); after every ring asks keep_going(bound) where bound
+            // is a lower bound on the distance from (x, y) to any cell not visited yet, INT64_MAX once none are left
+            template<typename VisitCell, typename KeepGoing>
+            void visit_rings(uint32_t x, uint32_t y, VisitCell visit_cell, KeepGoing keep_going) const {
+                if (grid_x == 0 || grid_y == 0) {
+                    return;
+                }
+                const auto cx = static_cast<int64_t>(clamp_cell(x, min_x, grid_x));
+                const auto cy = static_cast<int64_t>(clamp_cell(y, min_y, grid_y));
+                auto visit = [&](int64_t i, int64_t j) {
+                    if (i >= 0 && i < int64_t(grid_x)) {
+                        visit_cell(size_t(j) * grid_x + size_t(i));
+                    }
+                };
+                for (int64_t r = 0;; r++) {
+                    for (int64_t j = max<int64_t>(cy - r, 0); j <= min<int64_t>(cy + r, grid_y - 1); j++) {
+                        if (j == cy - r || j == cy + r) {
+                            for (int64_t i = cx - r; i <= cx + r; i++) {
+                                visit(i, j);
+                            }
+                        } else {
+                            visit(cx - r, j);
+                            visit(cx + r, j);
+                        }
+                    }
+                    int64_t bound = INT64_MAX;
+                    if (cx - r > 0) {
+                        bound = min(bound, int64_t(x) - (int64_t(min_x) + (cx - r) * cell_size) + 1);
+                    }
+                    if (cx + r < int64_t(grid_x) - 1) {
+                        bound = min(bound, int64_t(min_x) + (cx + r + 1) * cell_size - int64_t(x));
+                    }
+                    if (cy - r > 0) {
+                        bound = min(bound, int64_t(y) - (int64_t(min_y) + (cy - r) * cell_size) + 1);
+                    }
+                    if (cy + r < int64_t(grid_y) - 1) {
+                        bound = min(bound, int64_t(min_y) + (cy + r + 1) * cell_size - int64_t(y));
+                    }
+                    if (bound == INT64_MAX || !keep_going(bound)) {
+                        return;
+                    }
+                }
+            }
+        };
+
+        // running minimum with the rules of a linear scan: smallest squared distance, then the smallest id
+        struct NearestCandidate {
+            size_t id = npos;
+            uint64_t squared = 0;
+
+            void offer(uint32_t x, uint32_t y, uint32_t point_x, uint32_t point_y, size_t point_id) {
+                uint64_t d = squared_distance(x, y, point_x, point_y);
+                if (id == npos || d < squared || (d == squared && point_id < id)) {
+                    squared = d;
+                    id = point_id;
+                }
+            }
+
+            [[nodiscard]] float distance() const {
+                return (float) sqrt(double(squared));
+            }
+
+            // nothing at `bound` or farther can still win
+            [[nodiscard]] bool settled(int64_t bound) const {
+                return id != npos && (bound > int64_t(UINT32_MAX) || uint64_t(bound) * uint64_t(bound) > squared);
+            }
+        };
+
+        // uniform bucket grid over points (anything with x_center/y_center), ids are positions in the source vector
+        class PointGridIndex {
+        public:
+            static constexpr size_t npos = spatial_index::npos;
+
+            PointGridIndex() = default;
+
+            template<typename Points>
+            explicit PointGridIndex(const Points &points) {
+                build(points);
+            }
+
+            template<typename Points>
+            void build(const Points &points) {
+                point_x.clear();
+                point_y.clear();
+                point_id.clear();
+                cell_start.clear();
+                grid = GridGeometry();
+                if (points.empty()) {
+                    return;
+                }
+                uint32_t max_x = 0, max_y = 0;
+                grid.min_x = grid.min_y = UINT32_MAX;
+                for (const auto &p: points) {
+                    grid.min_x = min(grid.min_x, p.x_center);
+                    grid.min_y = min(grid.min_y, p.y_center);
+                    max_x = max(max_x, p.x_center);
+                    max_y = max(max_y, p.y_center);
+                }
+                // about two points per cell on average
+                double area = (double(max_x - grid.min_x) + 1) * (double(max_y - grid.min_y) + 1);
+                grid.cell_size = max<uint32_t>(1, static_cast<uint32_t>(ceil(sqrt(area * 2 / double(points.size())))));
+                grid.grid_x = (max_x - grid.min_x) / grid.cell_size + 1;
+                grid.grid_y = (max_y - grid.min_y) / grid.cell_size + 1;
+
+                // counting sort by cell, stable, so ids stay ascending inside a cell
+                cell_start.assign(grid.cell_count() + 1, 0);
+                for (const auto &p: points) {
+                    cell_start[grid.cell_of(p.x_center, p.y_center) + 1]++;
+                }
+                for (size_t i = 1; i < cell_start.size(); i++) {
+                    cell_start[i] += cell_start[i - 1];
+                }
+                point_x.resize(points.size());
+                point_y.resize(points.size());
+                point_id.resize(points.size());
+                vector<uint32_t> fill(cell_start.begin(), cell_start.end() - 1);
+                uint32_t id = 0;
+                for (const auto &p: points) {
+                    uint32_t slot = fill[grid.cell_of(p.x_center, p.y_center)]++;
+                    point_x[slot] = p.x_center;
+                    point_y[slot] = p.y_center;
+                    point_id[slot] = id++;
+                }
+            }
+
+            [[nodiscard]] bool empty() const {
+                return point_id.empty();
+            }
+
+            // same answer as a linear scan keeping the first point with the smallest distance_func value
+            [[nodiscard]] size_t nearest(uint32_t x, uint32_t y) const {
+                NearestCandidate best;
+                grid.visit_rings(x, y, [&](size_t cell) {
+                    for (uint32_t k = cell_start[cell]; k < cell_start[cell + 1]; k++) {
+                        best.offer(x, y, point_x[k], point_y[k], point_id[k]);
+                    }
+                }, [&best](int64_t bound) { return !best.settled(bound); });
+                return best.id;
+            }
+
+        private:
+            GridGeometry grid;
+            vector<uint32_t> cell_start;
+            vector<uint32_t> point_x;
+            vector<uint32_t> point_y;
+            vector<uint32_t> point_id;
+        };
+
+        // brute force nearest point search over 16 bit coordinates for many houses per pass over the points.
+        // Squared distances of coordinates in [0, 2^15) stay below 2^31, so the kernels compare them exactly
+        namespace nearest_kernels {
+            // nearest[h] = position of the first point with the smallest squared distance to house h, point_count > 0
+            using NearestFunction = void (*)(const int16_t *, const int16_t *, size_t, const int16_t *,
+                                             const int16_t *, size_t, uint32_t *);
+
+            struct NearestKernel {
+                const char *name;
+                NearestFunction nearest;
+            };
+
+            // houses sharing each load of the points
+            constexpr size_t houses_per_pass = 4;
+
+            // carries the running minimum of one house over the points [from, point_count)
+            inline void nearest_tail(const int16_t *point_x, const int16_t *point_y, size_t from, size_t point_count,
+                                     int32_t x, int32_t y, int32_t &best_squared, uint32_t &best) {
+                for (size_t i = from; i < point_count; i++) {
+                    int32_t dx = point_x[i] - x;
+                    int32_t dy = point_y[i] - y;
+                    int32_t squared = dx * dx + dy * dy;
+                    if (squared < best_squared) {
+                        best_squared = squared;
+                        best = static_cast<uint32_t>(i);
+                    }
+                }
+            }
+
+            // first lane with the smallest squared distance, ties to the lower point
+            inline void reduce_lanes(const int32_t *squared, const int32_t *index, size_t lanes, int32_t &best_squared,
+                                     uint32_t &best) {
+                for (size_t l = 0; l < lanes; l++) {
+                    auto i = static_cast<uint32_t>(index[l]);
+                    if (squared[l] < best_squared || (squared[l] == best_squared && i < best)) {
+                        best_squared = squared[l];
+                        best = i;
+                    }
+                }
+            }
+
+            inline void nearest_scalar(const int16_t *point_x, const int16_t *point_y, size_t point_count,
+                                       const int16_t *house_x, const int16_t *house_y, size_t house_count,
+                                       uint32_t *nearest) {
+                for (size_t h = 0; h < house_count; h++) {
+                    int32_t best_squared = INT32_MAX;
+                    uint32_t best = UINT32_MAX;
+                    nearest_tail(point_x, point_y, 0, point_count, house_x[h], house_y[h], best_squared, best);
+                    nearest[h] = best;
+                }
+            }
+
+#ifdef MAP_PROCESSING_X86_KERNELS
+            // the points are interleaved to (x, y) pairs once per load, madd then squares and adds dx and dy.
+            // Lane l of an accumulator sees the points l, l + 4, l + 8, ... in order, so a strict < keeps the first
+            inline void nearest_sse2(const int16_t *point_x, const int16_t *point_y, size_t point_count,
+                                     const int16_t *house_x, const int16_t *house_y, size_t house_count,
+                                     uint32_t *nearest) {
+                const size_t vector_end = point_count & ~size_t(7);
+                auto closer = [](__m128i squared, __m128i index, __m128i &best_squared, __m128i &best) {
+                    __m128i mask = _mm_cmplt_epi32(squared, best_squared);
+                    best_squared = _mm_or_si128(_mm_and_si128(mask, squared), _mm_andnot_si128(mask, best_squared));
+                    best = _mm_or_si128(_mm_and_si128(mask, index), _mm_andnot_si128(mask, best));
+                };
+                for (size_t h0 = 0; h0 < house_count; h0 += houses_per_pass) {
+                    const size_t block = min(houses_per_pass, house_count - h0);
+                    __m128i house[houses_per_pass], best_squared[houses_per_pass], best[houses_per_pass];
+                    for (size_t h = 0; h < houses_per_pass; h++) {
+                        // a short block repeats its last house
+                        size_t k = h0 + min(h, block - 1);
+                        house[h] = _mm_set1_epi32(int32_t(uint16_t(house_x[k])) | int32_t(uint32_t(house_y[k]) << 16));
+                        best_squared[h] = _mm_set1_epi32(INT32_MAX);
+                        best[h] = _mm_setzero_si128();
+                    }
+                    __m128i index_low = _mm_setr_epi32(0, 1, 2, 3);
+                    __m128i index_high = _mm_setr_epi32(4, 5, 6, 7);
+                    for (size_t i = 0; i < vector_end; i += 8) {
+                        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(point_x + i));
+                        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(point_y + i));
+                        __m128i low = _mm_unpacklo_epi16(x, y);
+                        __m128i high = _mm_unpackhi_epi16(x, y);
+                        for (size_t h = 0; h < houses_per_pass; h++) {
+                            __m128i d_low = _mm_sub_epi16(low, house[h]);
+                            __m128i d_high = _mm_sub_epi16(high, house[h]);
+                            closer(_mm_madd_epi16(d_low, d_low), index_low, best_squared[h], best[h]);
+                            closer(_mm_madd_epi16(d_high, d_high), index_high, best_squared[h], best[h]);
+                        }
+                        index_low = _mm_add_epi32(index_low, _mm_set1_epi32(8));
+                        index_high = _mm_add_epi32(index_high, _mm_set1_epi32(8));
+                    }
+                    for (size_t h = 0; h < block; h++) {
+                        int32_t squared = INT32_MAX;
+                        uint32_t index = UINT32_MAX;
+                        if (vector_end != 0) {
+                            int32_t lane_squared[4], lane_index[4];
+                            _mm_storeu_si128(reinterpret_cast<__m128i *>(lane_squared), best_squared[h]);
+                            _mm_storeu_si128(reinterpret_cast<__m128i *>(lane_index), best[h]);
+                            reduce_lanes(lane_squared, lane_index, 4, squared, index);
+                        }
+                        nearest_tail(point_x, point_y, vector_end, point_count, house_x[h0 + h], house_y[h0 + h],
+                                     squared, index);
+                        nearest[h0 + h] = index;
+                    }
+                }
+            }
+
+            // as nearest_sse2 with 16 points per load; unpack works per 128 bit half, so the low pairs are the
+            // points 0-3 and 8-11, the high ones 4-7 and 12-15
+            __attribute__((target("avx2")))
+            inline void nearest_avx2(const int16_t *point_x, const int16_t *point_y, size_t point_count,
+                                     const int16_t *house_x, const int16_t *house_y, size_t house_count,
+                                     uint32_t *nearest) {
+                const size_t vector_end = point_count & ~size_t(15);
+                for (size_t h0 = 0; h0 < house_count; h0 += houses_per_pass) {
+                    const size_t block = min(houses_per_pass, house_count - h0);
+                    __m256i house[houses_per_pass], best_squared[houses_per_pass], best[houses_per_pass];
+                    for (size_t h = 0; h < houses_per_pass; h++) {
+                        size_t k = h0 + min(h, block - 1);
+                        house[h] = _mm256_set1_epi32(int32_t(uint16_t(house_x[k])) |
+                                                     int32_t(uint32_t(house_y[k]) << 16));
+                        best_squared[h] = _mm256_set1_epi32(INT32_MAX);
+                        best[h] = _mm256_setzero_si256();
+                    }
+                    __m256i index_low = _mm256_setr_epi32(0, 1, 2, 3, 8, 9, 10, 11);
+                    __m256i index_high = _mm256_setr_epi32(4, 5, 6, 7, 12, 13, 14, 15);
+                    for (size_t i = 0; i < vector_end; i += 16) {
+                        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(point_x + i));
+                        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(point_y + i));
+                        __m256i low = _mm256_unpacklo_epi16(x, y);
+                        __m256i high = _mm256_unpackhi_epi16(x, y);
+                        for (size_t h = 0; h < houses_per_pass; h++) {
+                            __m256i d_low = _mm256_sub_epi16(low, house[h]);
+                            __m256i d_high = _mm256_sub_epi16(high, house[h]);
+                            __m256i squared = _mm256_madd_epi16(d_low, d_low);
+                            __m256i mask = _mm256_cmpgt_epi32(best_squared[h], squared);
+                            best_squared[h] = _mm256_blendv_epi8(best_squared[h], squared, mask);
+                            best[h] = _mm256_blendv_epi8(best[h], index_low, mask);
+                            squared = _mm256_madd_epi16(d_high, d_high);
+                            mask = _mm256_cmpgt_epi32(best_squared[h], squared);
+                            best_squared[h] = _mm256_blendv_epi8(best_squared[h], squared, mask);
+                            best[h] = _mm256_blendv_epi8(best[h], index_high, mask);
+                        }
+                        index_low = _mm256_add_epi32(index_low, _mm256_set1_epi32(16));
+                        index_high = _mm256_add_epi32(index_high, _mm256_set1_epi32(16));
+                    }
+                    for (size_t h = 0; h < block; h++) {
+                        int32_t squared = INT32_MAX;
+                        uint32_t index = UINT32_MAX;
+                        if (vector_end != 0) {
+                            int32_t lane_squared[8], lane_index[8];
+                            _mm256_storeu_si256(reinterpret_cast<__m256i *>(lane_squared), best_squared[h]);
+                            _mm256_storeu_si256(reinterpret_cast<__m256i *>(lane_index), best[h]);
+                            reduce_lanes(lane_squared, lane_index, 8, squared, index);
+                        }
+                        nearest_tail(point_x, point_y, vector_end, point_count, house_x[h0 + h], house_y[h0 + h],
+                                     squared, index);
+                        nearest[h0 + h] = index;
+                    }
+                }
+            }
+#endif
+
+            inline const NearestKernel scalar_kernel = {"scalar", &nearest_scalar};
+#ifdef MAP_PROCESSING_X86_KERNELS
+            inline const NearestKernel sse2_kernel = {"sse2", &nearest_sse2};
+            inline const NearestKernel avx2_kernel = {"avx2", &nearest_avx2};
+#endif
+
+            // kernels the running cpu can execute, best last
+            inline vector<const NearestKernel *> available_kernels() {
+                vector<const NearestKernel *> kernels = {&scalar_kernel};
+#ifdef MAP_PROCESSING_X86_KERNELS
+                kernels.push_back(&sse2_kernel);
+                if (__builtin_cpu_supports("avx2")) {
+                    kernels.push_back(&avx2_kernel);
+                }
+#endif
+                return kernels;
+            }
+
+            // kernel used by StationArrays, can be replaced e.g. for benchmarking
+            inline const NearestKernel *&active_kernel() {
+                static const NearestKernel *kernel = available_kernels().back();
+                return kernel;
+            }
+        }
+
+        // points as separate x and y arrays for a brute force nearest search, ids are positions in the source
+        // vector; same answers as PointGridIndex, cheaper for few points
+        class StationArrays {
+        public:
+            static constexpr size_t npos = spatial_index::npos;
+
+            template<typename Points>
+            explicit StationArrays(const Points &points) {
+                x.reserve(points.size());
+                y.reserve(points.size());
+                for (const auto &p: points) {
+                    x.push_back(p.x_center);
+                    y.push_back(p.y_center);
+                    narrow = narrow && fits_narrow(p.x_center, p.y_center);
+                }
+                if (narrow) {
+                    narrow_x.assign(x.begin(), x.end());
+                    narrow_y.assign(y.begin(), y.end());
+                }
+            }
+
+            [[nodiscard]] size_t size() const {
+                return x.size();
+            }
+
+            // the nearest point of every house in order, npos without points
+            template<typename Points>
+            [[nodiscard]] vector<size_t> nearest(const Points &houses) const {
+                vector<size_t> nearest(houses.size(), npos);
+                if (x.empty()) {
+                    return nearest;
+                }
+                constexpr size_t batch = 256;
+                int16_t batch_x[batch], batch_y[batch];
+                uint32_t found[batch];
+                size_t position[batch];
+                size_t used = 0;
+                auto flush = [&] {
+                    nearest_kernels::active_kernel()->nearest(narrow_x.data(), narrow_y.data(), x.size(), batch_x,
+                                                              batch_y, used, found);
+                    for (size_t k = 0; k < used; k++) {
+                        nearest[position[k]] = found[k];
+                    }
+                    used = 0;
+                };
+                size_t h = 0;
+                for (const auto &house: houses) {
+                    if (narrow && fits_narrow(house.x_center, house.y_center)) {
+                        batch_x[used] = static_cast<int16_t>(house.x_center);
+                        batch_y[used] = static_cast<int16_t>(house.y_center);
+                        position[used++] = h;
+                        if (used == batch) {
+                            flush();
+                        }
+                    } else {
+                        // exact 64 bit distances
+                        NearestCandidate best;
+                        for (size_t i = 0; i < x.size(); i++) {
+                            best.offer(house.x_center, house.y_center, x[i], y[i], i);
+                        }
+                        nearest[h] = best.id;
+                    }
+                    h++;
+                }
+                if (used != 0) {
+                    flush();
+                }
+                return nearest;
+            }
+
+        private:
+            static bool fits_narrow(uint32_t px, uint32_t py) {
+                return px <= uint32_t(INT16_MAX) && py <= uint32_t(INT16_MAX);
+            }
+
+            vector<uint32_t> x;
+            vector<uint32_t> y;
+            bool narrow = true;
+            vector<int16_t> narrow_x;
+            vector<int16_t> narrow_y;
+        };
+
+        // grid with fixed cells over a known area that points can be added to and removed from one by one;
+        // points outside the area go to the border cells, which keeps the ring search exact
+        class GrowingPointGrid {
+        public:
+            GrowingPointGrid() : GrowingPointGrid(1, 1, 1) {}
+
+            GrowingPointGrid(uint32_t x_size, uint32_t y_size, uint32_t cell_size) {
+                grid.cell_size = max<uint32_t>(cell_size, 1);
+                grid.grid_x = max<uint32_t>(x_size, 1) / grid.cell_size + 1;
+                grid.grid_y = max<uint32_t>(y_size, 1) / grid.cell_size + 1;
+                cells.resize(grid.cell_count());
+            }
+
+            void insert(uint32_t x, uint32_t y, size_t id) {
+                cells[cell_containing(x, y)].push_back({x, y, id});
+                point_count++;
+            }
+
+            void erase(uint32_t x, uint32_t y, size_t id) {
+                auto &cell = cells[cell_containing(x, y)];
+                for (size_t k = 0; k < cell.size(); k++) {
+                    if (cell[k].id == id) {
+                        cell[k] = cell.back();
+                        cell.pop_back();
+                        point_count--;
+                        return;
+                    }
+                }
+            }
+
+            [[nodiscard]] size_t size() const {
+                return point_count;
+            }
+
+            // same rules as PointGridIndex::nearest
+            [[nodiscard]] NearestCandidate nearest(uint32_t x, uint32_t y) const {
+                NearestCandidate best;
+                if (point_count == 0) {
+                    return best;
+                }
+                grid.visit_rings(x, y, [&](size_t cell) {
+                    for (const auto &p: cells[cell]) {
+                        best.offer(x, y, p.x, p.y, p.id);
+                    }
+                }, [&best](int64_t bound) { return !best.settled(bound); });
+                return best;
+            }
+
+            // the k nearest points as (distance, id), nearest first, ties by id like nearest()
+            [[nodiscard]] pmr::vector<pair<float, size_t>> nearest_k(
+                    uint32_t x, uint32_t y, size_t k, pmr::memory_resource *resource = pmr::get_default_resource()) const {
+                pmr::vector<pair<float, size_t>> nearest(resource);
+                if (k == 0 || point_count == 0) {
+                    return nearest;
+                }
+                // max-heap of the best k so far by (squared distance, id), the worst on top
+                pmr::vector<pair<uint64_t, size_t>> best(resource);
+                grid.visit_rings(x, y, [&](size_t cell) {
+                    for (const auto &p: cells[cell]) {
+                        pair<uint64_t, size_t> candidate{squared_distance(x, y, p.x, p.y), p.id};
+                        if (best.size() < k) {
+                            best.push_back(candidate);
+                            push_heap(best.begin(), best.end());
+                        } else if (candidate < best.front()) {
+                            pop_heap(best.begin(), best.end());
+                            best.back() = candidate;
+                            push_heap(best.begin(), best.end());
+                        }
+                    }
+                }, [&](int64_t bound) {
+                    return best.size() < k || bound > int64_t(UINT32_MAX) ||
+                           uint64_t(bound) * uint64_t(bound) <= best.front().first;
+                });
+                sort_heap(best.begin(), best.end());
+                nearest.reserve(best.size());
+                for (const auto &b: best) {
+                    nearest.emplace_back((float) sqrt(double(b.first)), b.second);
+                }
+                return nearest;
+            }
+
+            // calls visit(x, y, id) for every point closer than radius, and for some farther ones
+            template<typename Visit>
+            void for_each_near(uint32_t x, uint32_t y, float radius, Visit visit) const {
+                grid.visit_rings(x, y, [&](size_t cell) {
+                    for (const auto &p: cells[cell]) {
+                        visit(p.x, p.y, p.id);
+                    }
+                }, [radius](int64_t bound) { return float(bound) <= radius; });
+            }
+
+        private:
+            struct Point {
+                uint32_t x;
+                uint32_t y;
+                size_t id;
+            };
+
+            [[nodiscard]] size_t cell_containing(uint32_t x, uint32_t y) const {
+                return size_t(grid.clamp_cell(y, grid.min_y, grid.grid_y)) * grid.grid_x +
+                       grid.clamp_cell(x, grid.min_x, grid.grid_x);
+            }
+
+            GridGeometry grid;
+            vector<vector<Point>> cells;
+            size_t point_count = 0;
+        };
+    }
+
+    namespace table_editing {
+        using processing_types::HouseStationTable;
+        using spatial_index::GrowingPointGrid;
+        using math_utils::distance_func;
+        using math_utils::squared_distance;
+
+        // adds, moves and removes houses and stations of a finished table in place. Only houses that can change
+        // their station are looked at again: a station's new houses are all within the largest assigned distance
+        // of it, and a station's own houses are searched again when it moves or goes. Only the slices of the
+        // touched stations in the station -> houses index are rebuilt, the rest is copied over.
+        class HouseStationTableEditor {
+        public:
+            struct Update {
+                // the added or edited house or station
+                size_t id = 0;
+                // stations whose houses changed, ascending
+                vector<uint32_t> changed_stations;
+                size_t reassigned_houses = 0;
+            };
+
+            explicit HouseStationTableEditor(HouseStationTable &table) : table(table) {
+                uint32_t max_x = 0, max_y = 0;
+                size_t live_stations = 0, live_houses = 0;
+                for (size_t s = 0; s < table.station_count(); s++) {
+                    if (table.has_station(s)) {
+                        max_x = max(max_x, table.station_x[s]);
+                        max_y = max(max_y, table.station_y[s]);
+                        live_stations++;
+                    }
+                }
+                for (size_t h = 0; h < table.house_count(); h++) {
+                    if (table.has_house(h)) {
+                        max_x = max(max_x, table.house_x[h]);
+                        max_y = max(max_y, table.house_y[h]);
+                        live_houses++;
+                    }
+                }
+                station_grid = GrowingPointGrid(max_x, max_y, cell_size(max_x, max_y, live_stations));
+                house_grid = GrowingPointGrid(max_x, max_y, cell_size(max_x, max_y, live_houses));
+                for (size_t s = 0; s < table.station_count(); s++) {
+                    if (table.has_station(s)) {
+                        station_grid.insert(table.station_x[s], table.station_y[s], s);
+                    }
+                }
+                for (size_t h = 0; h < table.house_count(); h++) {
+                    if (!table.has_house(h)) {
+                        continue;
+                    }
+                    house_grid.insert(table.house_x[h], table.house_y[h], h);
+                    if (table.house_station[h] == HouseStationTable::no_station) {
+                        coverage = numeric_limits<float>::infinity();
+                    }
+                }
+                for (float distance: table.station_house_distances) {
+                    coverage = max(coverage, distance);
+                }
+                station_dirty.resize(table.station_count());
+            }
+
+            // kept up to date by the edits, so queries can use them too
+            [[nodiscard]] const GrowingPointGrid &station_index() const {
+                return station_grid;
+            }
+
+            [[nodiscard]] const GrowingPointGrid &house_index() const {
+                return house_grid;
+            }
+
+            Update add_station(uint32_t x, uint32_t y) {
+                auto id = static_cast<uint32_t>(table.station_count());
+                table.station_x.push_back(x);
+                table.station_y.push_back(y);
+                station_dirty.push_back(false);
+                station_grid.insert(x, y, id);
+                claim_houses_around(id);
+                return finish(id);
+            }
+
+            Update move_station(size_t id, uint32_t x, uint32_t y) {
+                check_station(id);
+                auto station = static_cast<uint32_t>(id);
+                station_grid.erase(table.station_x[id], table.station_y[id], id);
+                table.station_x[id] = x;
+                table.station_y[id] = y;
+                station_grid.insert(x, y, id);
+                mark(station);
+                reassign_houses_of(station);
+                claim_houses_around(station);
+                return finish(id);
+            }
+
+            Update remove_station(size_t id) {
+                check_station(id);
+                auto station = static_cast<uint32_t>(id);
+                station_grid.erase(table.station_x[id], table.station_y[id], id);
+                table.station_x[id] = HouseStationTable::removed;
+                table.station_y[id] = HouseStationTable::removed;
+                mark(station);
+                reassign_houses_of(station);
+                return finish(id);
+            }
+
+            Update add_house(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+                auto id = static_cast<uint32_t>(table.house_count());
+                table.house_x.push_back(x);
+                table.house_y.push_back(y);
+                table.house_width.push_back(width);
+                table.house_height.push_back(height);
+                table.house_station.push_back(HouseStationTable::no_station);
+                house_grid.insert(x, y, id);
+                assign(id, nearest_station(x, y));
+                return finish(id);
+            }
+
+            Update move_house(size_t id, uint32_t x, uint32_t y) {
+                check_house(id);
+                auto house = static_cast<uint32_t>(id);
+                house_grid.erase(table.house_x[id], table.house_y[id], id);
+                table.house_x[id] = x;
+                table.house_y[id] = y;
+                house_grid.insert(x, y, id);
+                // the distance changes even if the station does not
+                mark(table.house_station[id]);
+                changed_houses.push_back(house);
+                assign(house, nearest_station(x, y));
+                return finish(id);
+            }
+
+            Update remove_house(size_t id) {
+                check_house(id);
+                auto house = static_cast<uint32_t>(id);
+                house_grid.erase(table.house_x[id], table.house_y[id], id);
+                table.house_x[id] = HouseStationTable::removed;
+                table.house_y[id] = HouseStationTable::removed;
+                assign(house, HouseStationTable::no_station);
+                return finish(id);
+            }
+
+        private:
+            // about two points per cell
+            static uint32_t cell_size(uint32_t max_x, uint32_t max_y, size_t points) {
+                double area = (double(max_x) + 1) * (double(max_y) + 1);
+                return max<uint32_t>(1, static_cast<uint32_t>(ceil(sqrt(area * 2 / double(max<size_t>(points, 1))))));
+            }
+
+            void check_station(size_t id) const {
+                if (!table.has_station(id)) {
+                    throw ProcessingException("No such station!");
+                }
+            }
+
+            void check_house(size_t id) const {
+                if (!table.has_house(id)) {
+                    throw ProcessingException("No such house!");
+                }
+            }
+
+            uint32_t nearest_station(uint32_t x, uint32_t y) {
+                auto best = station_grid.nearest(x, y);
+                if (best.id == spatial_index::npos) {
+                    coverage = numeric_limits<float>::infinity();
+                    return HouseStationTable::no_station;
+                }
+                coverage = max(coverage, best.distance());
+                return static_cast<uint32_t>(best.id);
+            }
+
+            void mark(uint32_t station) {
+                if (station != HouseStationTable::no_station && !station_dirty[station]) {
+                    station_dirty[station] = true;
+                    dirty_stations.push_back(station);
+                }
+            }
+
+            void assign(uint32_t house, uint32_t station) {
+                uint32_t old_station = table.house_station[house];
+                if (old_station == station) {
+                    return;
+                }
+                mark(old_station);
+                mark(station);
+                table.house_station[house] = station;
+                changed_houses.push_back(house);
+                reassigned++;
+            }
+
+            // houses can only move to the station if it is closer than their current one, ties go to the lower id
+            void claim_houses_around(uint32_t station) {
+                const uint32_t sx = table.station_x[station];
+                const uint32_t sy = table.station_y[station];
+                house_grid.for_each_near(sx, sy, coverage, [&](uint32_t x, uint32_t y, size_t id) {
+                    auto house = static_cast<uint32_t>(id);
+                    uint32_t current = table.house_station[house];
+                    if (current == station) {
+                        return;
+                    }
+                    uint64_t distance = squared_distance(x, y, sx, sy);
+                    if (current != HouseStationTable::no_station) {
+                        uint64_t current_distance = squared_distance(x, y, table.station_x[current],
+                                                                     table.station_y[current]);
+                        if (distance > current_distance || (distance == current_distance && current < station)) {
+                            return;
+                        }
+                    }
+                    assign(house, station);
+                });
+            }
+
+            void reassign_houses_of(uint32_t station) {
+                if (station + size_t(1) >= table.station_house_offsets.size()) {
+                    return;
+                }
+                for (uint32_t k = table.station_house_offsets[station];
+                     k < table.station_house_offsets[station + 1]; k++) {
+                    uint32_t house = table.station_house_ids[k];
+                    assign(house, nearest_station(table.house_x[house], table.house_y[house]));
+                }
+            }
+
+            Update finish(size_t id) {
+                reindex();
+                table.station_field = nullptr;
+                Update update;
+                update.id = id;
+                update.reassigned_houses = reassigned;
+                update.changed_stations = std::move(dirty_stations);
+                sort(update.changed_stations.begin(), update.changed_stations.end());
+                for (uint32_t station: update.changed_stations) {
+                    station_dirty[station] = false;
+                }
+                dirty_stations.clear();
+                changed_houses.clear();
+                reassigned = 0;
+                return update;
+            }
+
+            // rebuilds the slices of the dirty stations and copies the others
+            void reindex() {
+                const auto &old_offsets = table.station_house_offsets;
+                const size_t old_stations = old_offsets.empty() ? 0 : old_offsets.size() - 1;
+                unordered_map<uint32_t, vector<uint32_t>> members;
+                for (uint32_t station: dirty_stations) {
+                    auto &ids = members[station];
+                    if (station < old_stations) {
+                        for (uint32_t k = old_offsets[station]; k < old_offsets[station + 1]; k++) {
+                            if (table.house_station[table.station_house_ids[k]] == station) {
+                                ids.push_back(table.station_house_ids[k]);
+                            }
+                        }
+                    }
+                }
+                for (uint32_t house: changed_houses) {
+                    uint32_t station = table.house_station[house];
+                    if (station != HouseStationTable::no_station) {
+                        members[station].push_back(house);
+                    }
+                }
+                for (auto &station_members: members) {
+                    auto &ids = station_members.second;
+                    sort(ids.begin(), ids.end());
+                    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+                }
+
+                const size_t station_count = table.station_count();
+                vector<uint32_t> offsets(station_count + 1, 0);
+                for (size_t s = 0; s < station_count; s++) {
+                    size_t size = station_dirty[s] ? members[uint32_t(s)].size()
+                                                   : s < old_stations ? old_offsets[s + 1] - old_offsets[s] : 0;
+                    offsets[s + 1] = offsets[s] + static_cast<uint32_t>(size);
+                }
+                vector<uint32_t> ids(offsets.back());
+                vector<float> distances(offsets.back());
+                for (size_t s = 0; s < station_count; s++) {
+                    if (!station_dirty[s]) {
+                        if (s < old_stations) {
+                            copy(table.station_house_ids.begin() + old_offsets[s],
+                                 table.station_house_ids.begin() + old_offsets[s + 1], ids.begin() + offsets[s]);
+                            copy(table.station_house_distances.begin() + old_offsets[s],
+                                 table.station_house_distances.begin() + old_offsets[s + 1],
+                                 distances.begin() + offsets[s]);
+                        }
+                        continue;
+                    }
+                    uint32_t slot = offsets[s];
+                    for (uint32_t house: members[uint32_t(s)]) {
+                        ids[slot] = house;
+                        distances[slot] = distance_func(table.house_x[house], table.house_y[house],
+                                                        table.station_x[s], table.station_y[s]);
+                        coverage = max(coverage, distances[slot]);
+                        slot++;
+                    }
+                }
+                table.station_house_offsets = std::move(offsets);
+                table.station_house_ids = std::move(ids);
+                table.station_house_distances = std::move(distances);
+            }
+
+            HouseStationTable &table;
+            GrowingPointGrid station_grid;
+            GrowingPointGrid house_grid;
+            // every assigned house is at most this far from its station, infinite while some house has none
+            float coverage = 0;
+            vector<char> station_dirty;
+            vector<uint32_t> dirty_stations;
+            vector<uint32_t> changed_houses;
+            size_t reassigned = 0;
+        };
+    }
+
+    namespace tiny_database {
+        using processing_types::HouseStationTable;
+        using processing_types::write_house;
+        using processing_types::write_station;
+        using output_utils::BufferedWriter;
+        using output_utils::StringSink;
+        using string_utils::strip;
+        using table_editing::HouseStationTableEditor;
+        using math_utils::distance_func;
+        using concurrency_utils::ThreadPool;
+
+        // formatted answers by query, split into shards that each keep their own LRU order under their own mutex.
+        // Every entry carries the version of the table data it was formatted from; a lookup with another version
+        // misses. The budget counts the answer bytes plus a fixed overhead per entry, answers over a shard's share
+        // of it are not kept
+        class ResultCache {
+        public:
+            struct Key {
+                uint32_t kind = 0;
+                uint64_t a = 0;
+                uint64_t b = 0;
+                uint64_t c = 0;
+
+                bool operator==(const Key &other) const {
+                    return kind == other.kind && a == other.a && b == other.b && c == other.c;
+                }
+            };
+
+            struct Stats {
+                size_t entries = 0;
+                size_t bytes = 0;
+                uint64_t hits = 0;
+                uint64_t misses = 0;
+                uint64_t evictions = 0;
+            };
+
+            static constexpr size_t entry_overhead = 128;
+
+            explicit ResultCache(size_t budget_bytes, size_t shard_count = 16)
+                    : shards(max<size_t>(shard_count, 1)), shard_budget(budget_bytes / max<size_t>(shard_count, 1)) {}
+
+            [[nodiscard]] bool enabled() const {
+                return shard_budget != 0;
+            }
+
+            shared_ptr<const string> find(const Key &key, uint64_t version) {
+                Shard &shard = shard_of(key);
+                lock_guard<mutex> lock(shard.mutex);
+                auto it = shard.entries.find(key);
+                if (it == shard.entries.end() || it->second->version != version) {
+                    shard.misses++;
+                    return nullptr;
+                }
+                shard.hits++;
+                shard.order.splice(shard.order.begin(), shard.order, it->second);
+                return it->second->answer;
+            }
+
+            // replaces an entry of another version, then evicts the least recently used entries over the budget
+            void insert(const Key &key, uint64_t version, shared_ptr<const string> answer) {
+                const size_t cost = answer->size() + entry_overhead;
+                if (cost > shard_budget) {
+                    return;
+                }
+                Shard &shard = shard_of(key);
+                lock_guard<mutex> lock(shard.mutex);
+                auto it = shard.entries.find(key);
+                if (it != shard.entries.end()) {
+                    shard.bytes -= it->second->cost;
+                    shard.order.erase(it->second);
+                    shard.entries.erase(it);
+                }
+                shard.order.push_front({key, version, std::move(answer), cost});
+                shard.entries.emplace(key, shard.order.begin());
+                shard.bytes += cost;
+                while (shard.bytes > shard_budget) {
+                    shard.bytes -= shard.order.back().cost;
+                    shard.entries.erase(shard.order.back().key);
+                    shard.order.pop_back();
+                    shard.evictions++;
+                }
+            }
+
+            [[nodiscard]] Stats stats() const {
+                Stats total;
+                for (const auto &shard: shards) {
+                    lock_guard<mutex> lock(shard.mutex);
+                    total.entries += shard.entries.size();
+                    total.bytes += shard.bytes;
+                    total.hits += shard.hits;
+                    total.misses += shard.misses;
+                    total.evictions += shard.evictions;
+                }
+                return total;
+            }
+
+        private:
+            struct Entry {
+                Key key;
+                uint64_t version;
+                shared_ptr<const string> answer;
+                size_t cost;
+            };
+
+            struct KeyHash {
+                size_t operator()(const Key &key) const {
+                    uint64_t h = key.kind;
+                    for (uint64_t part: {key.a, key.b, key.c}) {
+                        // splitmix64 finaliser over the running value
+                        h = (h ^ part) + 0x9E3779B97F4A7C15ULL;
+                        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+                        h ^= h >> 31;
+                    }
+                    return static_cast<size_t>(h);
+                }
+            };
+
+            // on its own cache line, so threads on different shards do not share one
+            struct alignas(64) Shard {
+                mutable std::mutex mutex;
+                // most recently used first
+                list<Entry> order;
+                unordered_map<Key, list<Entry>::iterator, KeyHash> entries;
+                size_t bytes = 0;
+                uint64_t hits = 0;
+                uint64_t misses = 0;
+                uint64_t evictions = 0;
+            };
+
+            Shard &shard_of(const Key &key) {
+                // the high bits, the low ones pick the bucket inside the shard
+                return shards[(KeyHash()(key) >> 40) % shards.size()];
+            }
+
+            vector<Shard> shards;
+            size_t shard_budget;
+        };
+
+        struct ResultCacheOptions {
+            // memory budget of CommandProcessor's cached answers, 0 disables the cache
+            size_t bytes = size_t(64) << 20;
+            // STATTRACE answers of this many stations, those with the most houses, are cached up front
+            size_t warm_stations = 0;
+            size_t warm_threads = concurrency_utils::ThreadPool::default_thread_count();
+        };
+
+        class CommandProcessor {
+        public:
+            explicit CommandProcessor(shared_ptr<HouseStationTable> &hs_table,
+                                      const ResultCacheOptions &cache_options = {})
+                    : hs_table(hs_table), result_cache(cache_options.bytes),
+                      station_versions(hs_table->station_count(), 0) {
+                command_descriptions.emplace_back("SELECT",
+                                                  "[syntax: SELECT <HOUSES/STATIONS> <index>] show house or station with certain index");
+                command_descriptions.emplace_back("SHOW",
+                                                  "[syntax: SHOW <HOUSES/STATIONS>] show all instances of house or station");
+                command_descriptions.emplace_back("STATTRACE",
+                                                  "[syntax: STATTRACE <index> [TOP <n> / LIMIT <n> [OFFSET <m>]]] showing the houses, connected to a certain station, farthest first");
+                command_descriptions.emplace_back("HOUSEREL",
+                                                  "[syntax: HOUSEREL <index/ALL>] showing all houses and stations they are connected");
+                command_descriptions.emplace_back("NEAREST",
+                                                  "[syntax: NEAREST <x> <y> <k>] showing the k stations closest to a point");
+                command_descriptions.emplace_back("WITHIN",
+                                                  "[syntax: WITHIN <station index> <radius>] showing all houses within radius of a station");
+                command_descriptions.emplace_back("STATION",
+                                                  "[syntax: STATION ADD <x> <y> / STATION MOVE <index> <x> <y> / STATION REMOVE <index>] edit stations, houses are reassigned");
+                command_descriptions.emplace_back("HOUSE",
+                                                  "[syntax: HOUSE ADD <x> <y> <width> <height> / HOUSE MOVE <index> <x> <y> / HOUSE REMOVE <index>] edit houses");
+                command_descriptions.emplace_back("STATS",
+                                                  "[syntax: STATS] stage timings, counters and command latencies (needs --profile)");
+                if (auto *profiler = profiling::active_profiler()) {
+                    profiler->record_table(hs_table->house_count(), hs_table->station_count());
+                }
+                if (result_cache.enabled() && cache_options.warm_stations != 0) {
+                    warm_up(cache_options.warm_stations, cache_options.warm_threads);
+                }
+            }
+
+            [[nodiscard]] ResultCache::Stats result_cache_stats() const {
+                return result_cache.stats();
+            }
+
+            void print_command_descriptions() {
+                cout << "AVAILABLE COMMANDS:" << endl;
+                for (const auto &i: command_descriptions) {
+                    cout << i.first << ": " << i.second << endl;
+                }
+            }
+
+            void write_command_descriptions(BufferedWriter &out) const {
+                out << "AVAILABLE COMMANDS:\n";
+                for (const auto &i: command_descriptions) {
+                    out << i.first << ": " << i.second << '\n';
+                }
+            }
+
+            static constexpr const char *invalid_command = "INVALID COMMAND, type help to see all available commands";
+
+            // a command as process_command runs it once the text is parsed. Programmatic callers can prepare a
+            // command once, or fill one in directly, and run it with execute() without touching any text
+            struct PreparedQuery {
+                enum Kind : uint8_t {
+                    invalid, stats, select_house, select_station, show_houses, show_stations, station_trace,
+                    house_relation, house_relations_all, nearest, within, add_station, move_station, remove_station,
+                    add_house, move_house, remove_house
+                };
+
+                Kind kind = invalid;
+                // the house or station the query is about
+                size_t index = 0;
+                // STATTRACE writes the ranks [offset, offset + limit), NEAREST the limit closest stations
+                size_t offset = 0;
+                size_t limit = SIZE_MAX;
+                // NEAREST's point, where ADD and MOVE put the house or station, and the size of an added house
+                uint32_t x = 0;
+                uint32_t y = 0;
+                uint32_t width = 0;
+                uint32_t height = 0;
+                float radius = 0;
+                // the answer of an invalid query
+                const char *message = invalid_command;
+                // a MOVE whose target did not parse, answered as invalid once the index is known to exist
+                bool invalid_target = false;
+            };
+
+            // never throws on malformed text, such a command becomes an invalid query carrying its error message
+            static PreparedQuery prepare(string_view command) {
+                const char *blanks = " \t\r\n";
+                command.remove_prefix(min(command.find_first_not_of(blanks), command.size()));
+                command.remove_suffix(command.size() - (command.find_last_not_of(blanks) + 1));
+
+                size_t split_index = find_split_index(command);
+                string_view name = command.substr(0, split_index);
+                if (split_index == string_view::npos) {
+                    // the only command without arguments
+                    return equals_upper(name, "STATS") ? PreparedQuery{PreparedQuery::stats} : PreparedQuery{};
+                }
+                string_view args = command.substr(split_index + 1);
+                // the length tells the names apart except for two pairs
+                switch (name.size()) {
+                    case 4:
+                        if (equals_upper(name, "SHOW")) {
+                            return prepare_show(args);
+                        }
+                        break;
+                    case 5:
+                        if (equals_upper(name, "HOUSE")) {
+                            return prepare_house_edit(args);
+                        }
+                        break;
+                    case 6:
+                        if (equals_upper(name, "SELECT")) {
+                            return prepare_select(args);
+                        }
+                        if (equals_upper(name, "WITHIN")) {
+                            return prepare_within(args);
+                        }
+                        break;
+                    case 7:
+                        if (equals_upper(name, "NEAREST")) {
+                            return prepare_nearest(args);
+                        }
+                        if (equals_upper(name, "STATION")) {
+                            return prepare_station_edit(args);
+                        }
+                        break;
+                    case 8:
+                        if (equals_upper(name, "HOUSEREL")) {
+                            return prepare_house_rel(args);
+                        }
+                        break;
+                    case 9:
+                        if (equals_upper(name, "STATTRACE")) {
+                            return prepare_stat_trace(args);
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                return {};
+            }
+
+            string process_command(string_view command) {
+                StringSink sink;
+                {
+                    BufferedWriter out(sink, 4096);
+                    process_command(command, out);
+                }
+                return sink.text;
+            }
+
+            // writes the answer without a trailing newline; safe to call from several threads at once
+            void process_command(string_view command, BufferedWriter &out) {
+                execute(prepare(command), out);
+            }
+
+            // as process_command, for a query from prepare() or one filled in by the caller
+            void execute(const PreparedQuery &query, BufferedWriter &out) {
+                struct ScratchRelease {
+                    ~ScratchRelease() {
+                        query_scratch().release();
+                    }
+                } release_scratch;
+                auto *profiler = profiling::active_profiler();
+                if (!profiler) {
+                    run_query(query, out);
+                    return;
+                }
+                auto start = chrono::steady_clock::now();
+                run_query(query, out);
+                auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+                profiler->command_histogram(command_name(query.kind)).record(static_cast<uint64_t>(elapsed.count()));
+            }
+
+        private:
+            // temporaries of a command live in the arena of its thread, execute releases it afterwards
+            template<typename T>
+            using ScratchVector = pmr::vector<T>;
+
+            static pmr::monotonic_buffer_resource &query_scratch() {
+                alignas(max_align_t) thread_local char initial_buffer[16 << 10];
+                thread_local pmr::monotonic_buffer_resource scratch(initial_buffer, sizeof(initial_buffer));
+                return scratch;
+            }
+
+            // the first max_words blank separated words of a text as views into it, and how many there are
+            struct Words {
+                static constexpr size_t max_words = 6;
+                array<string_view, max_words> word;
+                size_t count = 0;
+
+                [[nodiscard]] size_t size() const {
+                    return count;
+                }
+
+                string_view operator[](size_t i) const {
+                    return word[i];
+                }
+            };
+
+            static Words split_words(string_view text) {
+                Words words;
+                size_t start = text.find_first_not_of(" \t");
+                while (start != string_view::npos) {
+                    size_t end = text.find_first_of(" \t", start);
+                    if (words.count < Words::max_words) {
+                        words.word[words.count] = text.substr(start, end - start);
+                    }
+                    words.count++;
+                    start = end == string_view::npos ? end : text.find_first_not_of(" \t", end);
+                }
+                return words;
+            }
+
+            // `upper` is upper case already
+            static bool equals_upper(string_view text, string_view upper) {
+                if (text.size() != upper.size()) {
+                    return false;
+                }
+                for (size_t i = 0; i < text.size(); i++) {
+                    if (toupper(static_cast<unsigned char>(text[i])) != upper[i]) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // counts, indices and coordinates are read with from_chars after leading white space and an optional
+            // '+', up to the first other character. False without digits, when out of range, or for a negative
+            // number, which must not wrap around into a huge count
+            static bool parse_unsigned(string_view text, size_t &value) {
+                size_t start = text.find_first_not_of(" \t\n\v\f\r");
+                if (start == string_view::npos) {
+                    return false;
+                }
+                if (text[start] == '+') {
+                    start++;
+                }
+                unsigned long number = 0;
+                if (from_chars(text.data() + start, text.data() + text.size(), number).ec != errc()) {
+                    return false;
+                }
+                value = number;
+                return true;
+            }
+
+            // house and station indices stay in the range of an int
+            static bool parse_index(string_view text, size_t &value) {
+                return parse_unsigned(text, value) && value <= size_t(numeric_limits<int>::max());
+            }
+
+            // HouseStationTable::removed is not a valid coordinate
+            static bool parse_coordinate(string_view text, uint32_t &value) {
+                size_t number = 0;
+                if (!parse_unsigned(text, number) || number >= HouseStationTable::removed) {
+                    return false;
+                }
+                value = static_cast<uint32_t>(number);
+                return true;
+            }
+
+            // strtof's forms: decimal, inf and nan, and hexadecimal after 0x
+            static bool parse_float(string_view text, float &value) {
+                size_t start = text.find_first_not_of(" \t\n\v\f\r");
+                if (start == string_view::npos) {
+                    return false;
+                }
+                const bool negative = text[start] == '-';
+                if (text[start] == '-' || text[start] == '+') {
+                    start++;
+                }
+                const char *first = text.data() + start;
+                const char *last = text.data() + text.size();
+                if (first != last && *first == '-') {
+                    return false;
+                }
+                from_chars_result result{first, errc::invalid_argument};
+                if (last - first > 2 && first[0] == '0' && (first[1] == 'x' || first[1] == 'X') &&
+                    (isxdigit(static_cast<unsigned char>(first[2])) || first[2] == '.')) {
+                    result = from_chars(first + 2, last, value, chars_format::hex);
+                }
+                // without hex digits strtof reads the 0 in front of the x
+                if (result.ec == errc::invalid_argument) {
+                    result = from_chars(first, last, value);
+                }
+                if (result.ec != errc()) {
+                    return false;
+                }
+                // subnormal results are out of range, as strtof reports nearly all of them
+                if (value != 0 && fabs(value) < numeric_limits<float>::min()) {
+                    return false;
+                }
+                value = negative ? -value : value;
+                return true;
+            }
+
+            static size_t find_split_index(string_view str) {
+                for (char c: {' ', '\t'}) {
+                    size_t index = str.find(c);
+                    if (index != string_view::npos) {
+                        return index;
+                    }
+                }
+                return string_view::npos;
+            }
+
+            static PreparedQuery invalid_query(const char *message = invalid_command) {
+                PreparedQuery query;
+                query.message = message;
+                return query;
+            }
+
+            static PreparedQuery prepare_select(string_view args) {
+                size_t split_index = find_split_index(args);
+                if (split_index == string_view::npos) {
+                    return invalid_query("INVALID SELECT COMMAND, type help to see all available commands");
+                }
+                string_view table_name = args.substr(0, split_index);
+                PreparedQuery query;
+                if (!parse_index(args.substr(split_index + 1), query.index)) {
+                    return invalid_query();
+                }
+                if (equals_upper(table_name, "HOUSE")) {
+                    query.kind = PreparedQuery::select_house;
+                } else if (equals_upper(table_name, "STATION")) {
+                    query.kind = PreparedQuery::select_station;
+                } else {
+                    return invalid_query("NO MATCHING TABLE FOUND!");
+                }
+                return query;
+            }
+
+            static PreparedQuery prepare_show(string_view args) {
+                if (equals_upper(args, "HOUSE")) {
+                    return {PreparedQuery::show_houses};
+                }
+                if (equals_upper(args, "STATION")) {
+                    return {PreparedQuery::show_stations};
+                }
+                return invalid_query("NO MATCHING TABLE FOUND!");
+            }
+
+            static PreparedQuery prepare_stat_trace(string_view args) {
+                Words words = split_words(args);
+                PreparedQuery query{PreparedQuery::station_trace};
+                bool valid = true;
+                if (words.size() == 3 && (equals_upper(words[1], "TOP") || equals_upper(words[1], "LIMIT"))) {
+                    valid = parse_unsigned(words[2], query.limit);
+                } else if (words.size() == 5 && equals_upper(words[1], "LIMIT") && equals_upper(words[3], "OFFSET")) {
+                    valid = parse_unsigned(words[2], query.limit) && parse_unsigned(words[4], query.offset);
+                } else if (words.size() != 1) {
+                    return invalid_query("INVALID STATTRACE COMMAND, type help to see all available commands");
+                }
+                return valid && parse_index(words[0], query.index) ? query : invalid_query();
+            }
+
+            static PreparedQuery prepare_house_rel(string_view args) {
+                if (equals_upper(args, "ALL")) {
+                    return {PreparedQuery::house_relations_all};
+                }
+                PreparedQuery query{PreparedQuery::house_relation};
+                return parse_index(args, query.index) ? query : invalid_query();
+            }
+
+            static PreparedQuery prepare_nearest(string_view args) {
+                Words words = split_words(args);
+                if (words.size() != 3) {
+                    return invalid_query("INVALID NEAREST COMMAND, type help to see all available commands");
+                }
+                PreparedQuery query{PreparedQuery::nearest};
+                bool valid = parse_coordinate(words[0], query.x) && parse_coordinate(words[1], query.y) &&
+                             parse_unsigned(words[2], query.limit);
+                return valid ? query : invalid_query();
+            }
+
+            static PreparedQuery prepare_within(string_view args) {
+                Words words = split_words(args);
+                if (words.size() != 2) {
+                    return invalid_query("INVALID WITHIN COMMAND, type help to see all available commands");
+                }
+                PreparedQuery query{PreparedQuery::within};
+                bool valid = parse_unsigned(words[0], query.index) && parse_float(words[1], query.radius);
+                return valid ? query : invalid_query();
+            }
+
+            // ADD, MOVE and REMOVE of either table; adds take add_arguments coordinates
+            static PreparedQuery prepare_edit(string_view args, size_t add_arguments, PreparedQuery::Kind add,
+                                              PreparedQuery::Kind move, PreparedQuery::Kind remove,
+                                              const char *message) {
+                Words words = split_words(args);
+                string_view action = words.size() == 0 ? string_view() : words[0];
+                PreparedQuery query;
+                if (equals_upper(action, "ADD") && words.size() == add_arguments + 1) {
+                    query.kind = add;
+                    bool valid = parse_coordinate(words[1], query.x) && parse_coordinate(words[2], query.y) &&
+                                 (add_arguments < 4 || (parse_coordinate(words[3], query.width) &&
+                                                        parse_coordinate(words[4], query.height)));
+                    return valid ? query : invalid_query();
+                }
+                if ((equals_upper(action, "MOVE") && words.size() == 4) ||
+                    (equals_upper(action, "REMOVE") && words.size() == 2)) {
+                    query.kind = words.size() == 4 ? move : remove;
+                    if (!parse_unsigned(words[1], query.index)) {
+                        return invalid_query();
+                    }
+                    query.invalid_target = query.kind == move && !(parse_coordinate(words[2], query.x) &&
+                                                                   parse_coordinate(words[3], query.y));
+                    return query;
+                }
+                return invalid_query(message);
+            }
+
+            static PreparedQuery prepare_station_edit(string_view args) {
+                return prepare_edit(args, 2, PreparedQuery::add_station, PreparedQuery::move_station,
+                                    PreparedQuery::remove_station,
+                                    "INVALID STATION COMMAND, type help to see all available commands");
+            }
+
+            static PreparedQuery prepare_house_edit(string_view args) {
+                return prepare_edit(args, 4, PreparedQuery::add_house, PreparedQuery::move_house,
+                                    PreparedQuery::remove_house,
+                                    "INVALID HOUSE COMMAND, type help to see all available commands");
+            }
+
+            // the name the profiler files the query under
+            static const char *command_name(PreparedQuery::Kind kind) {
+                switch (kind) {
+                    case PreparedQuery::stats:
+                        return "STATS";
+                    case PreparedQuery::select_house:
+                    case PreparedQuery::select_station:
+                        return "SELECT";
+                    case PreparedQuery::show_houses:
+                    case PreparedQuery::show_stations:
+                        return "SHOW";
+                    case PreparedQuery::station_trace:
+                        return "STATTRACE";
+                    case PreparedQuery::house_relation:
+                    case PreparedQuery::house_relations_all:
+                        return "HOUSEREL";
+                    case PreparedQuery::nearest:
+                        return "NEAREST";
+                    case PreparedQuery::within:
+                        return "WITHIN";
+                    case PreparedQuery::add_station:
+                    case PreparedQuery::move_station:
+                    case PreparedQuery::remove_station:
+                        return "STATION";
+                    case PreparedQuery::add_house:
+                    case PreparedQuery::move_house:
+                    case PreparedQuery::remove_house:
+                        return "HOUSE";
+                    default:
+                        return "INVALID";
+                }
+            }
+
+            // read-only queries run side by side, edits run alone
+            void run_query(const PreparedQuery &query, BufferedWriter &out) {
+                switch (query.kind) {
+                    case PreparedQuery::invalid:
+                        out << query.message;
+                        return;
+                    case PreparedQuery::stats:
+                        stats_command(out);
+                        return;
+                    case PreparedQuery::add_station:
+                    case PreparedQuery::move_station:
+                    case PreparedQuery::remove_station: {
+                        unique_lock<shared_mutex> lock(table_mutex);
+                        station_edit(query, out);
+                        return;
+                    }
+                    case PreparedQuery::add_house:
+                    case PreparedQuery::move_house:
+                    case PreparedQuery::remove_house: {
+                        unique_lock<shared_mutex> lock(table_mutex);
+                        house_edit(query, out);
+                        return;
+                    }
+                    default:
+                        break;
+                }
+                shared_lock<shared_mutex> lock(table_mutex);
+                const size_t index = query.index;
+                switch (query.kind) {
+                    case PreparedQuery::select_house:
+                        cached_answer({query.kind, index}, table_generation, out, [&](BufferedWriter &text) {
+                            select_house(index, text);
+                        });
+                        break;
+                    case PreparedQuery::select_station:
+                        cached_answer({query.kind, index}, station_version(index), out, [&](BufferedWriter &text) {
+                            select_station(index, text);
+                        });
+                        break;
+                    case PreparedQuery::show_houses:
+                    case PreparedQuery::show_stations:
+                        show_command(query.kind, out);
+                        break;
+                    case PreparedQuery::station_trace:
+                        cached_answer({query.kind, index, query.offset, query.limit}, station_version(index), out,
+                                      [&](BufferedWriter &text) {
+                                          station_trace(index, query.offset, query.limit, text);
+                                      });
+                        break;
+                    case PreparedQuery::house_relation:
+                        cached_answer({query.kind, index}, table_generation, out, [&](BufferedWriter &text) {
+                            house_rel_by_index(index, text);
+                        });
+                        break;
+                    case PreparedQuery::house_relations_all:
+                        cached_answer({query.kind}, table_generation, out, [&](BufferedWriter &text) {
+                            house_relations(text);
+                        });
+                        break;
+                    case PreparedQuery::nearest:
+                        nearest_command(query.x, query.y, query.limit, out);
+                        break;
+                    case PreparedQuery::within:
+                        within_command(index, query.radius, out);
+                        break;
+                    default:
+                        out << invalid_command;
+                        break;
+                }
+            }
+
+            void stats_command(BufferedWriter &out) const {
+                auto *profiler = profiling::active_profiler();
+                if (!profiler) {
+                    out << "PROFILING IS DISABLED, start with --profile";
+                    return;
+                }
+                profiler->write_report(out);
+                auto cache = result_cache.stats();
+                out << "\nRESULT CACHE SIZE: " << cache.entries << " ENTRIES, " << cache.bytes << " BYTES, "
+                    << cache.evictions << " EVICTIONS";
+            }
+
+            void nearest_command(uint32_t x, uint32_t y, size_t k, BufferedWriter &out) {
+                auto nearest = editor().station_index().nearest_k(x, y, k, &query_scratch());
+                out << "{CORDS: {" << x << ", " << y << "}}";
+                if (nearest.empty()) {
+                    out << " -> NO STATIONS FOUND";
+                    return;
+                }
+                out << " (TOTAL " << nearest.size() << ") ->{\n";
+                for (const auto &station: nearest) {
+                    out << '\t';
+                    write_station(out, hs_table->station(station.second));
+                    out << " (distance: " << station.first << ")\n";
+                }
+                out << '}';
+            }
+
+            void within_command(size_t station_index, float radius, BufferedWriter &out) {
+                if (!hs_table->has_station(station_index)) {
+                    out << "NO MATCHING STATIONS FOUND";
+                    return;
+                }
+                const uint32_t sx = hs_table->station_x[station_index];
+                const uint32_t sy = hs_table->station_y[station_index];
+                // nearest first, ties by house id
+                ScratchVector<pair<float, size_t>> houses(&query_scratch());
+                editor().house_index().for_each_near(sx, sy, radius, [&](uint32_t x, uint32_t y, size_t id) {
+                    float distance = distance_func(x, y, sx, sy);
+                    if (distance <= radius) {
+                        houses.emplace_back(distance, id);
+                    }
+                });
+                sort(houses.begin(), houses.end());
+                write_station(out, hs_table->station(station_index));
+                if (houses.empty()) {
+                    out << " -> NO HOUSES FOUND";
+                    return;
+                }
+                out << " (TOTAL " << houses.size() << ") ->{\n";
+                for (const auto &house: houses) {
+                    out << '\t';
+                    write_house(out, hs_table->house(house.second));
+                    out << " (distance: " << house.first << ")\n";
+                }
+                out << '}';
+            }
+
+            void station_edit(const PreparedQuery &query, BufferedWriter &out) {
+                HouseStationTableEditor::Update update;
+                if (query.kind == PreparedQuery::add_station) {
+                    update = editor().add_station(query.x, query.y);
+                } else {
+                    if (!hs_table->has_station(query.index)) {
+                        out << "NO MATCHING STATIONS FOUND";
+                        return;
+                    }
+                    if (query.invalid_target) {
+                        out << invalid_command;
+                        return;
+                    }
+                    update = query.kind == PreparedQuery::move_station
+                             ? editor().move_station(query.index, query.x, query.y)
+                             : editor().remove_station(query.index);
+                }
+                forget_answers(update.changed_stations, update.id);
+                if (query.kind == PreparedQuery::remove_station) {
+                    out << "STAT" << update.id << " REMOVED";
+                } else {
+                    write_station(out, hs_table->station(update.id));
+                }
+                out << " (" << update.reassigned_houses << " HOUSES REASSIGNED)";
+            }
+
+            void house_edit(const PreparedQuery &query, BufferedWriter &out) {
+                HouseStationTableEditor::Update update;
+                if (query.kind == PreparedQuery::add_house) {
+                    update = editor().add_house(query.x, query.y, query.width, query.height);
+                } else {
+                    if (!hs_table->has_house(query.index)) {
+                        out << "NO MATCHING HOUSES FOUND";
+                        return;
+                    }
+                    if (query.invalid_target) {
+                        out << invalid_command;
+                        return;
+                    }
+                    update = query.kind == PreparedQuery::move_house
+                             ? editor().move_house(query.index, query.x, query.y)
+                             : editor().remove_house(query.index);
+                }
+                forget_answers(update.changed_stations);
+                if (query.kind == PreparedQuery::remove_house) {
+                    out << "HOUSE" << update.id << " REMOVED";
+                    return;
+                }
+                write_house(out, hs_table->house(update.id));
+                out << " -> ";
+                write_assigned_station(update.id, out);
+            }
+
+            // built on first use; its grids also serve NEAREST and WITHIN, which run under the shared table lock
+            HouseStationTableEditor &editor() {
+                call_once(table_editor_built, [this] {
+                    table_editor = make_unique<HouseStationTableEditor>(*hs_table);
+                });
+                return *table_editor;
+            }
+
+            // called under the exclusive table lock after an edit: answers about a changed station, and all
+            // answers about houses, no longer match their entries
+            void forget_answers(const vector<uint32_t> &stations, size_t edited_station = SIZE_MAX) {
+                station_versions.resize(hs_table->station_count(), 0);
+                for (uint32_t station: stations) {
+                    station_versions[station]++;
+                }
+                if (edited_station < station_versions.size()) {
+                    station_versions[edited_station]++;
+                }
+                table_generation++;
+            }
+
+            // read under the shared table lock; unknown stations share version 0, their answers do not change
+            [[nodiscard]] uint64_t station_version(size_t station_index) const {
+                return station_index < station_versions.size() ? station_versions[station_index] : 0;
+            }
+
+            // writes the cached answer to `key`, or formats it with format(writer) and caches the text
+            template<typename Format>
+            void cached_answer(const ResultCache::Key &key, uint64_t version, BufferedWriter &out, Format format) {
+                if (!result_cache.enabled()) {
+                    format(out);
+                    return;
+                }
+                auto answer = result_cache.find(key, version);
+                if (auto *profiler = profiling::active_profiler()) {
+                    (answer ? profiler->result_cache_hits : profiler->result_cache_misses)
+                            .fetch_add(1, memory_order_relaxed);
+                }
+                if (!answer) {
+                    answer = format_answer(format);
+                    result_cache.insert(key, version, answer);
+                }
+                out << *answer;
+            }
+
+            template<typename Format>
+            static shared_ptr<const string> format_answer(Format format) {
+                StringSink sink;
+                {
+                    BufferedWriter text(sink, 4096);
+                    format(text);
+                }
+                return make_shared<const string>(std::move(sink.text));
+            }
+
+            // caches the full STATTRACE answers of the stations with the most houses, spread over a thread pool
+            void warm_up(size_t station_count, size_t thread_count) {
+                vector<uint32_t> stations;
+                for (size_t s = 0; s < hs_table->station_count(); s++) {
+                    if (hs_table->has_station(s)) {
+                        stations.push_back(static_cast<uint32_t>(s));
+                    }
+                }
+                const auto &offsets = hs_table->station_house_offsets;
+                station_count = min(station_count, stations.size());
+                partial_sort(stations.begin(), stations.begin() + ptrdiff_t(station_count), stations.end(),
+                             [&offsets](uint32_t a, uint32_t b) {
+                                 uint32_t houses_a = offsets[a + 1] - offsets[a];
+                                 uint32_t houses_b = offsets[b + 1] - offsets[b];
+                                 return houses_a > houses_b || (houses_a == houses_b && a < b);
+                             });
+                ThreadPool pool(max<size_t>(min(thread_count, station_count), 1));
+                vector<future<void>> pending;
+                const size_t slice = (station_count + pool.size() - 1) / max<size_t>(pool.size(), 1);
+                for (size_t begin = 0; begin < station_count; begin += slice) {
+                    pending.push_back(pool.submit([&, begin] {
+                        shared_lock<shared_mutex> lock(table_mutex);
+                        for (size_t k = begin; k < min(begin + slice, station_count); k++) {
+                            size_t station = stations[k];
+                            auto answer = format_answer([&](BufferedWriter &text) {
+                                station_trace(station, 0, SIZE_MAX, text);
+                            });
+                            query_scratch().release();
+                            result_cache.insert({PreparedQuery::station_trace, station, 0, SIZE_MAX},
+                                                station_version(station), std::move(answer));
+                        }
+                    }));
+                }
+                for (auto &task: pending) {
+                    task.get();
+                }
+            }
+
+            void select_house(size_t index, BufferedWriter &out) {
+                if (!hs_table->has_house(index)) {
+                    out << "NO MATCHING HOUSES FOUND";
+                    return;
+                }
+                write_house(out, hs_table->house(index));
+            }
+
+            void select_station(size_t index, BufferedWriter &out) {
+                if (!hs_table->has_station(index)) {
+                    out << "NO MATCHING STATIONS FOUND";
+                    return;
+                }
+                write_station(out, hs_table->station(index));
+            }
+
+            void show_command(PreparedQuery::Kind kind, BufferedWriter &out) {
+                if (kind == PreparedQuery::show_houses) {
+                    for (size_t i = 0; i < hs_table->house_count(); i++) {
+                        if (hs_table->has_house(i)) {
+                            write_house(out, hs_table->house(i));
+                            out << '\n';
+                        }
+                    }
+                } else {
+                    for (size_t i = 0; i < hs_table->station_count(); i++) {
+                        if (hs_table->has_station(i)) {
+                            write_station(out, hs_table->station(i));
+                            out << '\n';
+                        }
+                    }
+                }
+            }
+
+            // houses of the station ranked farthest first, ranks [offset, offset + limit) are written; only those
+            // ranks are sorted, the rest is just partitioned off
+            void station_trace(size_t station_index, size_t offset, size_t limit, BufferedWriter &out) {
+                if (!hs_table->has_station(station_index)) {
+                    out << "NO MATCHING STATIONS FOUND";
+                    return;
+                }
+                const uint32_t first = hs_table->station_house_offsets[station_index];
+                const uint32_t last = hs_table->station_house_offsets[station_index + 1];
+                const size_t total = last - first;
+                const size_t begin = min(offset, total);
+                const size_t end = begin + min(limit, total - begin);
+                // positions relative to the station's CSR slice; equal distances keep the slice order, as a stable
+                // sort would
+                const float *distances = hs_table->station_house_distances.data() + first;
+                auto farther = [distances](uint32_t a, uint32_t b) {
+                    return distances[a] > distances[b] || (distances[a] == distances[b] && a < b);
+                };
+                ScratchVector<uint32_t> positions(total, &query_scratch());
+                iota(positions.begin(), positions.end(), 0);
+                if (end < total) {
+                    nth_element(positions.begin(), positions.begin() + ptrdiff_t(end), positions.end(), farther);
+                }
+                if (begin > 0) {
+                    nth_element(positions.begin(), positions.begin() + ptrdiff_t(begin),
+                                positions.begin() + ptrdiff_t(end), farther);
+                }
+                sort(positions.begin() + ptrdiff_t(begin), positions.begin() + ptrdiff_t(end), farther);
+                write_station(out, hs_table->station(station_index));
+                if (total == 0) {
+                    out << " -> NO HOUSES FOUND";
+                    return;
+                }
+                out << " (TOTAL " << total << ") ->{\n";
+                for (size_t rank = begin; rank < end; rank++) {
+                    uint32_t position = positions[rank];
+                    out << '\t';
+                    write_house(out, hs_table->house(hs_table->station_house_ids[first + position]));
+                    out << " (distance: " << distances[position] << ")\n";
+                }
+                out << '}';
+            }
+
+            void write_assigned_station(size_t house_index, BufferedWriter &out) {
+                uint32_t station_index = hs_table->house_station[house_index];
+                if (station_index == HouseStationTable::no_station) {
+                    out << "NO STATION";
+                    return;
+                }
+                write_station(out, hs_table->station(station_index));
+            }
+
+            void house_relations(BufferedWriter &out) {
+                for (size_t i = 0; i < hs_table->house_count(); i++) {
+                    if (!hs_table->has_house(i)) {
+                        continue;
+                    }
+                    write_house(out, hs_table->house(i));
+                    out << " <- ";
+                    write_assigned_station(i, out);
+                    out << '\n';
+                }
+            }
+
+            void house_rel_by_index(size_t house_index, BufferedWriter &out) {
+                if (!hs_table->has_house(house_index)) {
+                    out << "NO MATCHING HOUSES FOUND";
+                    return;
+                }
+                write_house(out, hs_table->house(house_index));
+                out << " -> ";
+                write_assigned_station(house_index, out);
+            }
+
+            shared_mutex table_mutex;
+            unique_ptr<HouseStationTableEditor> table_editor;
+            once_flag table_editor_built;
+            vector<pair<string, string>> command_descriptions;
+
+            shared_ptr<HouseStationTable> hs_table;
+            ResultCache result_cache;
+            // bumped by the edits, under the exclusive table lock: a station's version whenever its houses or the
+            // station itself change, the generation on every edit
+            vector<uint64_t> station_versions;
+            uint64_t table_generation = 0;
+        };
+    }
+
+    namespace UI {
+        using processing_types::HouseStationTable;
+        using tiny_database::CommandProcessor;
+        using tiny_database::ResultCacheOptions;
+        using output_utils::BufferedWriter;
+        using output_utils::StreamSink;
+        using output_utils::StringSink;
+        using concurrency_utils::ThreadPool;
+        using string_utils::strip;
+
+        using PreparedQuery = CommandProcessor::PreparedQuery;
+
+        // one answer of the non-interactive front ends: what ConsoleUI prints for an upper-cased command, `query`
+        // is the command prepared
+        inline void run_command(CommandProcessor &command_processor, const string &command, const PreparedQuery &query,
+                                BufferedWriter &out) {
+            if (command == "HELP") {
+                command_processor.write_command_descriptions(out);
+                return;
+            }
+            try {
+                command_processor.execute(query, out);
+            } catch (const exception &) {
+                out << CommandProcessor::invalid_command;
+            }
+            out << '\n';
+        }
+
+        inline void run_command(CommandProcessor &command_processor, const string &command, BufferedWriter &out) {
+            run_command(command_processor, command, CommandProcessor::prepare(command), out);
+        }
+
+        class ConsoleUI : public FinalProcessingUnit {
+        public:
+            explicit ConsoleUI(ResultCacheOptions cache_options = {}) : cache_options(cache_options) {}
+
+            void process(shared_ptr<ProcessingData> data) override {
+                cout << "type *help* to start\n";
+                auto hs_table = dynamic_pointer_cast<HouseStationTable>(data);
+                if (!hs_table) {
+                    throw ProcessingDataTypeMissmatch("Type missmatch in ConsoleUI: expected HouseStationTable!");
+                }
+                auto commandProcessor = new CommandProcessor(hs_table, cache_options);
+                StreamSink console(cout);
+                BufferedWriter out(console);
+                string current_command;
+                while (getline(cin, current_command)) {
+                    strip(current_command);
+                    transform(current_command.begin(), current_command.end(), current_command.begin(), ::toupper);
+                    if (current_command == "EXIT") {
+                        break;
+                    }
+                    if (current_command == "HELP") {
+                        commandProcessor->print_command_descriptions();
+                    } else {
+                        commandProcessor->process_command(current_command, out);
+                        out << '\n';
+                        out.flush();
+                    }
+                }
+                delete commandProcessor;
+            }
+
+        private:
+            ResultCacheOptions cache_options;
+        };
+
+        // non-interactive front end: runs a file (or stdin for "-") of commands on a thread pool against the
+        // read-only table and prints the answers in input order, one answer per line like ConsoleUI
+        class BatchUI : public FinalProcessingUnit {
+        public:
+            explicit BatchUI(string input_path, size_t thread_count = ThreadPool::default_thread_count(),
+                             ostream &output = cout, ResultCacheOptions cache_options = {})
+                    : input_path(std::move(input_path)), thread_count(max<size_t>(thread_count, 1)), output(output),
+                      cache_options(cache_options) {}
+
+            void process(shared_ptr<ProcessingData> data) override {
+                auto hs_table = dynamic_pointer_cast<HouseStationTable>(data);
+                if (!hs_table) {
+                    throw ProcessingDataTypeMissmatch("Type missmatch in BatchUI: expected HouseStationTable!");
+                }
+                ifstream file;
+                if (input_path != "-") {
+                    file.open(input_path);
+                    if (!file.is_open()) {
+                        throw ProcessingException("Can not open the command file!");
+                    }
+                }
+                istream &input = input_path == "-" ? cin : file;
+
+                CommandProcessor command_processor(hs_table, cache_options);
+                ThreadPool pool(thread_count);
+                StreamSink sink(output);
+                BufferedWriter out(sink);
+                vector<string> commands;
+                vector<PreparedQuery> queries;
+                vector<StringSink> answers(thread_count);
+                bool finished = false;
+                while (!finished) {
+                    commands.clear();
+                    queries.clear();
+                    string line;
+                    while (commands.size() < batch_size && getline(input, line)) {
+                        strip(line);
+                        transform(line.begin(), line.end(), line.begin(), ::toupper);
+                        if (line == "EXIT") {
+                            finished = true;
+                            break;
+                        }
+                        queries.push_back(CommandProcessor::prepare(line));
+                        commands.push_back(std::move(line));
+                    }
+                    if (commands.size() < batch_size) {
+                        finished = true;
+                    }
+
+                    // every edit is a barrier: the reads before it run side by side, then the edit runs alone
+                    for (size_t begin = 0; begin < commands.size();) {
+                        size_t end = begin;
+                        // STATION and HOUSE commands, the last kinds, change the table
+                        while (end < commands.size() && queries[end].kind < PreparedQuery::add_station) {
+                            end++;
+                        }
+                        run_reads(command_processor, pool, commands, queries, begin, end, answers, out);
+                        if (end < commands.size()) {
+                            run_command(command_processor, commands[end], queries[end], out);
+                            end++;
+                        }
+                        begin = end;
+                    }
+                }
+            }
+
+        private:
+            // commands [begin, end) in contiguous slices over the pool, answers written in command order
+            void run_reads(CommandProcessor &command_processor, ThreadPool &pool, const vector<string> &commands,
+                           const vector<PreparedQuery> &queries, size_t begin, size_t end,
+                           vector<StringSink> &answers, BufferedWriter &out) const {
+                size_t slice = (end - begin + thread_count - 1) / thread_count;
+                vector<future<void>> pending;
+                for (size_t t = 0; t < thread_count && begin + t * slice < end; t++) {
+                    pending.push_back(pool.submit([&, t] {
+                        answers[t].text.clear();
+                        BufferedWriter slice_out(answers[t]);
+                        for (size_t i = begin + t * slice; i < min(end, begin + (t + 1) * slice); i++) {
+                            run_command(command_processor, commands[i], queries[i], slice_out);
+                        }
+                    }));
+                }
+                for (size_t t = 0; t < pending.size(); t++) {
+                    pending[t].get();
+                    out << answers[t].text;
+                }
+            }
+
+            static constexpr size_t batch_size = 1 << 16;
+            string input_path;
+            size_t thread_count;
+            ostream &output;
+            ResultCacheOptions cache_options;
+        };
+
+        // serves the commands to many clients over a socket (see socket_utils::SocketAddress) with one epoll loop
+        // per thread, all sharing the CommandProcessor. Commands are lines, each answer is BatchUI's answer
+        // followed by a '\0', so clients may pipeline; EXIT closes the connection. Runs until SIGINT, SIGTERM
+        // or stop()
+        class SocketServerUI : public FinalProcessingUnit {
+        public:
+            explicit SocketServerUI(string address, size_t thread_count = ThreadPool::default_thread_count(),
+                                    ResultCacheOptions cache_options = {})
+                    : address(std::move(address)), thread_count(max<size_t>(thread_count, 1)),
+                      cache_options(cache_options), stop_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+            SocketServerUI(const SocketServerUI &) = delete;
+
+            SocketServerUI &operator=(const SocketServerUI &) = delete;
+
+            ~SocketServerUI() override {
+                close(stop_fd);
+            }
+
+            void process(shared_ptr<ProcessingData> data) override {
+                auto hs_table = dynamic_pointer_cast<HouseStationTable>(data);
+                if (!hs_table) {
+                    throw ProcessingDataTypeMissmatch("Type missmatch in SocketServerUI: expected HouseStationTable!");
+                }
+                CommandProcessor command_processor(hs_table, cache_options);
+                socket_utils::SocketAddress socket_address(address);
+                int listener = socket_utils::listen_socket(socket_address);
+
+                // the loops inherit the blocked signals, so they only reach signal_fd
+                sigset_t signals;
+                sigset_t previous_signals;
+                sigemptyset(&signals);
+                sigaddset(&signals, SIGINT);
+                sigaddset(&signals, SIGTERM);
+                pthread_sigmask(SIG_BLOCK, &signals, &previous_signals);
+                int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+
+                cerr << "LISTENING ON " << socket_utils::local_address(listener) << endl;
+                vector<thread> loops;
+                for (size_t t = 0; t < thread_count; t++) {
+                    loops.emplace_back([&] { event_loop(listener, command_processor); });
+                }
+                pollfd waits[] = {{signal_fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+                while (poll(waits, 2, -1) < 0 && errno == EINTR) {
+                }
+                if (waits[0].revents & POLLIN) {
+                    // taken off the pending set, or it would end the process once unblocked
+                    signalfd_siginfo signal_info{};
+                    ssize_t ignored = read(signal_fd, &signal_info, sizeof(signal_info));
+                    (void) ignored;
+                }
+                stop();
+                for (auto &loop: loops) {
+                    loop.join();
+                }
+                close(signal_fd);
+                pthread_sigmask(SIG_SETMASK, &previous_signals, nullptr);
+                close(listener);
+                if (socket_address.family() == AF_UNIX) {
+                    unlink(reinterpret_cast<const sockaddr_un *>(&socket_address.storage)->sun_path);
+                }
+                cerr << "SERVED " << connections_served.load() << " CONNECTIONS, " << commands_served.load()
+                     << " COMMANDS" << endl;
+            }
+
+            // safe from any thread or a signal handler
+            void stop() {
+                uint64_t one = 1;
+                ssize_t ignored = write(stop_fd, &one, sizeof(one));
+                (void) ignored;
+            }
+
+        private:
+            struct Connection {
+                int fd;
+                string input;
+                // answers not sent yet start at output.text[sent]
+                StringSink output;
+                size_t sent = 0;
+                uint32_t interest = 0;
+                // the client shut its side down, what it sent is still answered
+                bool input_done = false;
+                // EXIT or a broken request, nothing more is answered
+                bool closing = false;
+            };
+
+            void event_loop(int listener, CommandProcessor &command_processor) {
+                int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+                // every loop waits on the listener, EPOLLEXCLUSIVE wakes only one of them per connection
+                epoll_event event{};
+                event.events = EPOLLIN | EPOLLEXCLUSIVE;
+                event.data.fd = listener;
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener, &event);
+                event.events = EPOLLIN;
+                event.data.fd = stop_fd;
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event);
+
+                unordered_map<int, Connection> connections;
+                epoll_event events[64];
+                bool running = true;
+                while (running) {
+                    int ready = epoll_wait(epoll_fd, events, 64, -1);
+                    if (ready < 0 && errno != EINTR) {
+                        break;
+                    }
+                    for (int i = 0; i < ready; i++) {
+                        int fd = events[i].data.fd;
+                        if (fd == stop_fd) {
+                            running = false;
+                        } else if (fd == listener) {
+                            accept_connections(epoll_fd, listener, connections);
+                        } else {
+                            auto connection = connections.find(fd);
+                            if (connection != connections.end() &&
+                                !serve(epoll_fd, connection->second, events[i].events, command_processor)) {
+                                close(fd);
+                                connections.erase(connection);
+                            }
+                        }
+                    }
+                }
+                for (auto &connection: connections) {
+                    close(connection.first);
+                }
+                close(epoll_fd);
+            }
+
+            void accept_connections(int epoll_fd, int listener, unordered_map<int, Connection> &connections) {
+                while (true) {
+                    int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd < 0) {
+                        return;
+                    }
+                    int on = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                    Connection &connection = connections[fd];
+                    connection.fd = fd;
+                    connection.interest = EPOLLIN;
+                    epoll_event event{};
+                    event.events = EPOLLIN;
+                    event.data.fd = fd;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+                    connections_served.fetch_add(1, memory_order_relaxed);
+                }
+            }
+
+            // false once the connection is to be closed
+            bool serve(int epoll_fd, Connection &connection, uint32_t events, CommandProcessor &command_processor) {
+                if (events & EPOLLERR) {
+                    return false;
+                }
+                if ((events & (EPOLLIN | EPOLLHUP)) && !connection.closing && !connection.input_done) {
+                    char chunk[1 << 16];
+                    while (backlog(connection) < max_backlog) {
+                        ssize_t got = recv(connection.fd, chunk, sizeof(chunk), 0);
+                        if (got > 0) {
+                            connection.input.append(chunk, size_t(got));
+                            run_commands(connection, command_processor);
+                        } else if (got == 0) {
+                            connection.input_done = true;
+                            break;
+                        } else if (errno != EINTR) {
+                            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                                return false;
+                            }
+                            break;
+                        }
+                    }
+                }
+                if (!send_output(connection)) {
+                    return false;
+                }
+                // answers the commands held back while the backlog was full; no event may follow once all of the
+                // input is read and the answers went out at once, so keep going until they stop draining
+                while (backlog(connection) == 0 && !connection.closing && connection.input.find('\n') != string::npos) {
+                    run_commands(connection, command_processor);
+                    if (!send_output(connection)) {
+                        return false;
+                    }
+                }
+                if (backlog(connection) == 0 &&
+                    (connection.closing || (connection.input_done && connection.input.find('\n') == string::npos))) {
+                    return false;
+                }
+                bool reading = !connection.closing && !connection.input_done && backlog(connection) < max_backlog;
+                uint32_t interest = (reading ? uint32_t(EPOLLIN) : 0) |
+                                    (backlog(connection) != 0 ? uint32_t(EPOLLOUT) : 0);
+                if (interest != connection.interest) {
+                    epoll_event event{};
+                    event.events = interest;
+                    event.data.fd = connection.fd;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+                    connection.interest = interest;
+                }
+                return true;
+            }
+
+            // answers every complete line until the backlog fills up, the rest waits in input
+            void run_commands(Connection &connection, CommandProcessor &command_processor) {
+                size_t line_start = 0;
+                {
+                    BufferedWriter out(connection.output, 4096);
+                    size_t line_end;
+                    while (!connection.closing && backlog(connection) < max_backlog &&
+                           (line_end = connection.input.find('\n', line_start)) != string::npos) {
+                        string command = connection.input.substr(line_start, line_end - line_start);
+                        line_start = line_end + 1;
+                        strip(command);
+                        transform(command.begin(), command.end(), command.begin(), ::toupper);
+                        if (command == "EXIT") {
+                            connection.closing = true;
+                            break;
+                        }
+                        run_command(command_processor, command, out);
+                        out << '\0';
+                        out.flush();
+                        commands_served.fetch_add(1, memory_order_relaxed);
+                    }
+                }
+                connection.input.erase(0, line_start);
+                // complete lines may wait for the backlog to drain, only the unterminated tail counts
+                if (connection.input.size() - (connection.input.rfind('\n') + 1) > max_line) {
+                    connection.output.text += "COMMAND IS TOO LONG\n";
+                    connection.output.text += '\0';
+                    connection.closing = true;
+                }
+            }
+
+            // false on a broken connection
+            static bool send_output(Connection &connection) {
+                string &text = connection.output.text;
+                while (connection.sent < text.size()) {
+                    ssize_t put = send(connection.fd, text.data() + connection.sent, text.size() - connection.sent,
+                                       MSG_NOSIGNAL);
+                    if (put < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        return errno == EAGAIN || errno == EWOULDBLOCK;
+                    }
+                    connection.sent += size_t(put);
+                }
+                text.clear();
+                connection.sent = 0;
+                return true;
+            }
+
+            static size_t backlog(const Connection &connection) {
+                return connection.output.text.size() - connection.sent;
+            }
+
+            static constexpr size_t max_backlog = size_t(1) << 20;
+            static constexpr size_t max_line = size_t(1) << 16;
+            string address;
+            size_t thread_count;
+            ResultCacheOptions cache_options;
+            int stop_fd;
+            atomic<size_t> connections_served{0};
+            atomic<size_t> commands_served{0};
+        };
+    }
+
+    namespace IO {
+
+        using processing_types::TextData;
+        using processing_types::HouseStationMap;
+        using processing_types::RunLengthMap;
+        using processing_types::CellRun;
+        using processing_types::HouseStationSet;
+        using processing_types::HouseStationTable;
+        using processing_types::house_to_string;
+        using processing_types::station_to_string;
+
+        class HouseStationPrinter : public DataProcessor {
+        public:
+            HouseStationPrinter() = default;
+
+            shared_ptr<ProcessingData> process(shared_ptr<ProcessingData> processingData) override {
+                auto hs_set = dynamic_pointer_cast<HouseStationSet>(processingData);
+                if (!hs_set) {
+                    throw ProcessingDataTypeMissmatch(
+                            "Types missmatch in HouseStationPrinter: expected HouseStationSet!");
+                }
+                cout << "Houses <House_Name>: {CORDS: {x, y}; SIZE: {x, y}}" << endl;
+                for (auto i: hs_set->houses) {
+                    cout << house_to_string(i) << endl;
+                }
+                cout << "Stations <Station_name>: {CORDS: {x, y}}";
+                for (auto i: hs_set->stations) {
+                    cout << station_to_string(i) << endl;
+                }
+                return hs_set;
+            }
+        };
+
+        class ReadFile : public DataProcessor {
+        public:
+            static const char *name() {
+                return "ReadFile";
+            }
+
+            explicit ReadFile() = default;
+
+            shared_ptr<ProcessingData> process(shared_ptr<ProcessingData> processingData) override {
+                auto file_name = dynamic_pointer_cast<TextData>(processingData);
+                if (!file_name) {
+                    throw ProcessingDataTypeMissmatch("Data missmatch in ReadFile, expected TextData!");
+                }
+                return make_shared<HouseStationMap>(apply(*file_name));
+            }
+
+            HouseStationMap apply(const TextData &file_name) const {
+                ifstream fileStream;
+                fileStream.open(file_name.text, ios::binary);
+                if (!fileStream.is_open()) {
+                    throw ProcessingException("No such file or directory!");
+                }
+                uint32_t x_size;
+                uint32_t y_size;
+                fileStream.read(reinterpret_cast<char *>(&x_size), sizeof(x_size));
+                fileStream.read(reinterpret_cast<char *>(&y_size), sizeof(y_size));
+
+                if (!fileStream) {
+                    throw ProcessingException("File is invalid, less data, then expected");
+                }
+
+                size_t vector_size = static_cast<size_t>(x_size) * y_size;
+
+                fileStream.seekg(0, ios::end);
+                size_t fileSize = fileStream.tellg();
+                fileStream.seekg(header_size, ios::beg);
+
+                if (fileSize - header_size < vector_size) {
+                    throw ProcessingException("File is invalid, less data, then expected");
+                }
+
+                HouseStationMap hs_map(x_size, y_size);
+                fileStream.read(reinterpret_cast<char *>(hs_map.data()), static_cast<streamsize>(vector_size));
+                profiling::count_bytes_read(header_size + vector_size);
+                return hs_map;
+            }
+
+            static constexpr size_t header_size = 2 * sizeof(uint32_t);
+        };
+
+        // read-only private mapping of a whole file
+        class MappedFile {
+        public:
+            explicit MappedFile(const string &file_name) {
+                int fd = open(file_name.c_str(), O_RDONLY);
+                if (fd < 0) {
+                    throw ProcessingException("No such file or directory!");
+                }
+                struct stat file_stat{};
+                if (fstat(fd, &file_stat) != 0) {
+                    close(fd);
+                    throw ProcessingException("Can not stat the file!");
+                }
+                length = static_cast<size_t>(file_stat.st_size);
+                if (length != 0) {
+                    void *addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (addr == MAP_FAILED) {
+                        close(fd);
+                        throw ProcessingException("Can not map the file into memory!");
+                    }
+                    bytes = static_cast<const uint8_t *>(addr);
+                    madvise(addr, length, MADV_SEQUENTIAL);
+                }
+                close(fd);
+            }
+
+            MappedFile(const MappedFile &) = delete;
+
+            MappedFile &operator=(const MappedFile &) = delete;
+
+            ~MappedFile() {
+                if (bytes) {
+                    munmap(const_cast<uint8_t *>(bytes), length);
+                }
+            }
+
+            [[nodiscard]] const uint8_t *data() const {
+                return bytes;
+            }
+
+            [[nodiscard]] size_t size() const {
+                return length;
+            }
+
+        private:
+            const uint8_t *bytes = nullptr;
+            size_t length = 0;
+        };
+
+        // run-length map on disk: a fixed header, y_size + 1 row starts counted in runs, then the runs of every
+        // row in order (native byte order). Stored next to the raw format, the header tells them apart
+        namespace run_length_format {
+            constexpr char magic[8] = {'H', 'S', 'M', 'A', 'P', 'R', 'L', 'E'};
+            constexpr uint32_t version = 1;
+
+            struct Header {
+                char magic[8];
+                uint32_t version;
+                uint32_t header_size;
+                uint32_t x_size;
+                uint32_t y_size;
+                uint64_t run_count;
+            };
+
+            inline size_t file_size(uint32_t y_size, uint64_t run_count) {
+                return sizeof(Header) + (size_t(y_size) + 1) * sizeof(uint64_t) + run_count * sizeof(CellRun);
+            }
+
+            inline bool has_magic(const uint8_t *data, size_t size) {
+                return size >= sizeof(magic) && memcmp(data, magic, sizeof(magic)) == 0;
+            }
+
+            inline bool is_run_length_file(const string &file_name) {
+                ifstream file(file_name, ios::binary);
+                char head[sizeof(magic)] = {};
+                file.read(head, sizeof(head));
+                return file && has_magic(reinterpret_cast<const uint8_t *>(head), sizeof(head));
+            }
+
+            // one pass per row with the vectorized finders, cells other than 0, 1 and 2 are rejected
+            inline RunLengthMap encode(const HouseStationMap &hs_map) {
+                if (hs_map.x_size >= CellRun::station_bit) {
+                    throw ProcessingException("Map is too wide for the run-length format!");
+                }
+                const uint32_t x_size = hs_map.x_size;
+                vector<uint64_t> row_starts(size_t(hs_map.y_size) + 1);
+                vector<CellRun> runs;
+                for (uint32_t y = 0; y < hs_map.y_size; y++) {
+                    const uint8_t *row = hs_map.row(y);
+                    row_starts[y] = runs.size();
+                    auto x = static_cast<uint32_t>(scan_kernels::find_not_equal(row, 0, x_size, 0));
+                    while (x < x_size) {
+                        uint8_t value = row[x];
+                        if (value > 2) {
+                            throw ProcessingException("Map cells are expected to be 0, 1 or 2!");
+                        }
+                        auto end = static_cast<uint32_t>(scan_kernels::find_not_equal(row, x + 1, x_size, value));
+                        runs.push_back(CellRun::make(x, end - x, value));
+                        x = static_cast<uint32_t>(scan_kernels::find_not_equal(row, end, x_size, 0));
+                    }
+                }
+                row_starts[hs_map.y_size] = runs.size();
+                return {hs_map.x_size, hs_map.y_size, std::move(row_starts), std::move(runs)};
+            }
+
+            inline bool write(const RunLengthMap &rl_map, const string &file_name) {
+                Header header{};
+                memcpy(header.magic, magic, sizeof(magic));
+                header.version = version;
+                header.header_size = sizeof(Header);
+                header.x_size = rl_map.x_size;
+                header.y_size = rl_map.y_size;
+                header.run_count = rl_map.run_count();
+                ofstream file(file_name, ios::binary | ios::trunc);
+                file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+                file.write(reinterpret_cast<const char *>(rl_map.row_starts()),
+                           static_cast<streamsize>((size_t(rl_map.y_size) + 1) * sizeof(uint64_t)));
+                file.write(reinterpret_cast<const char *>(rl_map.runs()),
+                           static_cast<streamsize>(rl_map.run_count() * sizeof(CellRun)));
+                file.close();
+                return bool(file);
+            }
+
+            // the map straight over the mapping once every row is checked to hold sorted, maximal, in-bounds runs,
+            // which the run tracer relies on
+            inline RunLengthMap map_file(const shared_ptr<MappedFile> &mapping) {
+                Header header{};
+                if (mapping->size() < sizeof(header)) {
+                    throw ProcessingException("File is invalid, less data, then expected");
+                }
+                memcpy(&header, mapping->data(), sizeof(header));
+                if (!has_magic(mapping->data(), mapping->size()) || header.version != version ||
+                    header.header_size != sizeof(Header) ||
+                    header.run_count > (mapping->size() - sizeof(Header)) / sizeof(CellRun) ||
+                    file_size(header.y_size, header.run_count) != mapping->size()) {
+                    throw ProcessingException("Run-length map is invalid!");
+                }
+                auto row_starts = reinterpret_cast<const uint64_t *>(mapping->data() + sizeof(Header));
+                auto runs = reinterpret_cast<const CellRun *>(row_starts + size_t(header.y_size) + 1);
+                if (row_starts[0] != 0 || row_starts[header.y_size] != header.run_count) {
+                    throw ProcessingException("Run-length map is invalid!");
+                }
+                for (uint32_t y = 0; y < header.y_size; y++) {
+                    if (row_starts[y + 1] < row_starts[y] || row_starts[y + 1] > header.run_count) {
+                        throw ProcessingException("Run-length map is invalid!");
+                    }
+                    uint64_t previous_end = 0;
+                    uint8_t previous_value = 0;
+                    for (uint64_t r = row_starts[y]; r < row_starts[y + 1]; r++) {
+                        const CellRun &run = runs[r];
+                        bool touches = r != row_starts[y] && run.x == previous_end;
+                        if (run.length() == 0 || run.x < previous_end || uint64_t(run.x) + run.length() > header.x_size ||
+                            (touches && run.value() == previous_value)) {
+                            throw ProcessingException("Run-length map is invalid!");
+                        }
+                        previous_end = run.end();
+                        previous_value = run.value();
+                    }
+                }
+                profiling::count_bytes_read(mapping->size());
+                return {header.x_size, header.y_size, row_starts, runs, mapping};
+            }
+        }
+
+        // same format and checks as ReadFile, but the map points straight into the file mapping;
+        // run-length files are recognised by their header and decoded
+        class MappedReadFile : public DataProcessor {
+        public:
+            static const char *name() {
+                return "MappedReadFile";
+            }
+
+            MappedReadFile() = default;
+
+            shared_ptr<ProcessingData> process(shared_ptr<ProcessingData> processingData) override {
+                auto file_name = dynamic_pointer_cast<TextData>(processingData);
+                if (!file_name) {
+                    throw ProcessingDataTypeMissmatch("Data missmatch in MappedReadFile, expected TextData!");
+                }
+                return make_shared<HouseStationMap>(apply(*file_name));
+            }
+
+            HouseStationMap apply(const TextData &file_name) const {
+                auto mapping = make_shared<MappedFile>(file_name.text);
+                if (run_length_format::has_magic(mapping->data(), mapping->size())) {
+                    return run_length_format::map_file(mapping).decode();
+                }
+                if (mapping->size() < ReadFile::header_size) {
+                    throw ProcessingException("File is invalid, less data, then expected");
+                }
+                uint32_t x_size;
+                uint32_t y_size;
+                memcpy(&x_size, mapping->data(), sizeof(x_size));
+                memcpy(&y_size, mapping->data() + sizeof(x_size), sizeof(y_size));
+                if (mapping->size() - ReadFile::header_size < static_cast<size_t>(x_size) * y_size) {
+                    throw ProcessingException("File is invalid, less data, then expected");
+                }
+                const uint8_t *cells = mapping->data() + ReadFile::header_size;
+                profiling::count_bytes_read(ReadFile::header_size + static_cast<size_t>(x_size) * y_size);
+                return {x_size, y_size, cells, mapping};
+            }
+        };
+
+        // maps a run-length file without expanding it, raw files are encoded on the way in
+        class RunLengthReadFile : public DataProcessor {
+        public:
+            static const char *name() {
+                return "RunLengthReadFile";
+            }
+
+            RunLengthReadFile() = default;
+
+            shared_ptr<ProcessingData> process(shared_ptr<ProcessingData> processingData) override {
+                auto file_name = dynamic_pointer_cast<TextData>(processingData);
+                if (!file_name) {
+                    throw ProcessingDataTypeMissmatch("Data missmatch in RunLengthReadFile, expected TextData!");
+                }
+                return make_shared<RunLengthMap>(apply(*file_name));
+            }
+
+            RunLengthMap apply(const TextData &file_name) const {
+                auto mapping = make_shared<MappedFile>(file_name.text);
+                if (run_length_format::has_magic(mapping->data(), mapping->size())) {
+                    return run_length_format::map_file(mapping);
+                }
+                return run_length_format::encode(MappedReadFile().apply(file_name));
+            }
+        };
+
+        // cheap identity of a source file: size, modification time and its first and last 64 KiB, FNV-1a
+        inline uint64_t source_fingerprint(const string &file_name) {
+            int fd = open(file_name.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw ProcessingException("No such file or directory!");
+            }
+            struct stat file_stat{};
+            fstat(fd, &file_stat);
+            uint64_t hash = 14695981039346656037ull;
+            auto mix = [&hash](const void *data, size_t size) {
+                for (size_t i = 0; i < size; i++) {
+                    hash ^= static_cast<const uint8_t *>(data)[i];
+                    hash *= 1099511628211ull;
+                }
+            };
+            auto size = static_cast<uint64_t>(file_stat.st_size);
+            auto modified = static_cast<uint64_t>(file_stat.st_mtim.tv_sec) * 1000000000ull +
+                            static_cast<uint64_t>(file_stat.st_mtim.tv_nsec);
+            mix(&size, sizeof(size));
+            mix(&modified, sizeof(modified));
+            const size_t sample = size_t(64) << 10;
+            vector<uint8_t> block(sample);
+            ssize_t got = pread(fd, block.data(), sample, 0);
+            mix(block.data(), got > 0 ? size_t(got) : 0);
+            if (size > sample) {
+                got = pread(fd, block.data(), sample, static_cast<off_t>(size - min<uint64_t>(size, sample)));
+                mix(block.data(), got > 0 ? size_t(got) : 0);
+            }
+            close(fd);
+            return hash;
+        }
+
+        // finished HouseStationTable on disk: a fixed header followed by the table arrays, each 64-byte aligned
+        // so the file can be mapped and read in place (native byte order)
+        namespace snapshot_format {
+            constexpr char magic[8] = {'H', 'S', 'T', 'A', 'B', 'L', 'E', '\0'};
+            constexpr uint32_t version = 2;
+            constexpr size_t alignment = 64;
+
+            struct Header {
+                char magic[8];
+                uint32_t version;
+                uint32_t header_size;
+                uint64_t source_fingerprint;
+                uint64_t house_count;
+                uint64_t station_count;
+                uint64_t assigned_count;
+                uint64_t file_size;
+                uint32_t assignment;
+                uint32_t reserved;
+            };
+
+            // how the stations of the table were assigned; the ways may break ties between stations differently,
+            // so a snapshot only stands in for a table built the same way
+            enum Assignment : uint32_t {
+                nearest_station = 0, feature_transform = 1
+            };
+
+            inline string path_for(const string &source_file_name) {
+                return source_file_name + ".snapshot";
+            }
+
+            // every array of the table in file order
+            template<typename Table, typename Visitor>
+            void for_each_section(Table &table, Visitor visit) {
+                visit(table.house_x);
+                visit(table.house_y);
+                visit(table.house_width);
+                visit(table.house_height);
+                visit(table.house_station);
+                visit(table.station_x);
+                visit(table.station_y);
+                visit(table.station_house_offsets);
+                visit(table.station_house_ids);
+                visit(table.station_house_distances);
+            }
+
+            inline size_t aligned(size_t offset) {
+                return (offset + alignment - 1) / alignment * alignment;
+            }
+        }
+
+        // passes the table on unchanged after writing it next to the source file; a failed write only warns
+        class SaveSnapshot : public DataProcessor {
+        public:
+            static const char *name() {
+                return "SaveSnapshot";
+            }
+
+            explicit SaveSnapshot(string source_file_name,
+                                  snapshot_format::Assignment assignment = snapshot_format::nearest_station)
+                    : source_file_name(std::move(source_file_name)), assignment(assignment) {}
+
+            shared_ptr<ProcessingData> process(shared_ptr<ProcessingData> data) override {
+                auto hs_table = dynamic_pointer_cast<HouseStationTable>(data);
+                if (!hs_table) {
+                    throw ProcessingDataTypeMissmatch("Data missmatch in SaveSnapshot, expected HouseStationTable!");
+                }
+                save(*hs_table);
+                return hs_table;
+            }
+
+            HouseStationTable apply(HouseStationTable hs_table) {
+                save(hs_table);
+                return hs_table;
+            }
+
+        private:
+            void save(const HouseStationTable &hs_table) {
+                if (!write(hs_table)) {
+                    cerr << "Can not write the snapshot " << snapshot_format::path_for(source_file_name) << endl;
+                }
+            }
+
+            bool write(const HouseStationTable &hs_table) {
+                using namespace snapshot_format;
+                Header header{};
+                memcpy(header.magic, magic, sizeof(magic));
+                header.version = version;
+                header.header_size = sizeof(Header);
+                header.source_fingerprint = source_fingerprint(source_file_name);
+                header.house_count = hs_table.house_count();
+                header.station_count = hs_table.station_count();
+                header.assigned_count = hs_table.station_house_ids.size();
+                header.assignment = assignment;
+                size_t offset = aligned(sizeof(Header));
+                for_each_section(hs_table, [&offset](const auto &section) {
+                    offset = aligned(offset + section.size() * sizeof(section[0]));
+                });
+                header.file_size = offset;
+
+                string path = path_for(source_file_name);
+                string temporary_path = path + ".tmp";
+                ofstream file(temporary_path, ios::binary | ios::trunc);
+                if (!file.is_open()) {
+                    return false;
+                }
+                const char padding[alignment] = {};
+                file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+                size_t written = sizeof(header);
+                auto pad = [&] {
+                    file.write(padding, static_cast<streamsize>(aligned(written) - written));
+                    written = aligned(written);
+                };
+                pad();
+                for_each_section(hs_table, [&](const auto &section) {
+                    size_t bytes = section.size() * sizeof(section[0]);
+                    file.write(reinterpret_cast<const char *>(section.data()), static_cast<streamsize>(bytes));
+                    written += bytes;
+                    pad();
+                });
+                file.close();
+                if (!file || rename(temporary_path.c_str(), path.c_str()) != 0) {
+                    unlink(temporary_path.c_str());
+                    return false;
+                }
+                return true;
+            }
+
+            string source_file_name;
+            snapshot_format::Assignment assignment;
+        };
+
+        // builds the table from the snapshot of a source file, mapped and checked once by open(). The table is
+        // edited in place by STATION and HOUSE commands, so its arrays are copied out of the read-only mapping
+        class LoadSnapshot : public DataProcessor {
+        public:
+            // nullptr unless the snapshot of the file exists, matches it and the assignment, and is consistent
+            static shared_ptr<LoadSnapshot> open(const string &source_file_name,
+                                                 snapshot_format::Assignment assignment) {
+                try {
+                    auto mapping = make_unique<MappedFile>(snapshot_format::path_for(source_file_name));
+                    if (!matches(*mapping, source_fingerprint(source_file_name), assignment) ||
+                        !consistent(*mapping)) {
+                        return nullptr;
+                    }
+                    return shared_ptr<LoadSnapshot>(new LoadSnapshot(std::move(mapping)));
+                } catch (const ProcessingException &) {
+                    return nullptr;
+                }
+            }
+
+            // the TextData has to name the file open() was given
+            shared_ptr<ProcessingData> process(shared_ptr<ProcessingData> processingData) override {
+                if (!dynamic_pointer_cast<TextData>(processingData)) {
+                    throw ProcessingDataTypeMissmatch("Data missmatch in LoadSnapshot, expected TextData!");
+                }
+                snapshot_format::Header header{};
+                memcpy(&header, mapping->data(), sizeof(header));
+                profiling::count_bytes_read(mapping->size());
+
+                auto hs_table = make_shared<HouseStationTable>();
+                auto sizes = section_sizes(header);
+                size_t offset = snapshot_format::aligned(sizeof(header));
+                size_t section_index = 0;
+                snapshot_format::for_each_section(*hs_table, [&](auto &section) {
+                    section.resize(sizes[section_index++]);
+                    size_t bytes = section.size() * sizeof(section[0]);
+                    memcpy(section.data(), mapping->data() + offset, bytes);
+                    offset = snapshot_format::aligned(offset + bytes);
+                });
+                return hs_table;
+            }
+
+        private:
+            // element counts of the sections in file order
+            static array<size_t, 10> section_sizes(const snapshot_format::Header &header) {
+                return {header.house_count, header.house_count, header.house_count, header.house_count,
+                        header.house_count, header.station_count, header.station_count, header.station_count + 1,
+                        header.assigned_count, header.assigned_count};
+            }
+
+            explicit LoadSnapshot(unique_ptr<MappedFile> mapping) : mapping(std::move(mapping)) {}
+
+            static bool matches(const MappedFile &mapping, uint64_t fingerprint,
+                                snapshot_format::Assignment assignment) {
+                using namespace snapshot_format;
+                Header header{};
+                if (mapping.size() < sizeof(header)) {
+                    return false;
+                }
+                memcpy(&header, mapping.data(), sizeof(header));
+                if (memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version ||
+                    header.header_size != sizeof(Header) || header.source_fingerprint != fingerprint ||
+                    header.file_size != mapping.size() || header.assigned_count > header.house_count ||
+                    header.assignment != assignment) {
+                    return false;
+                }
+                size_t expected = aligned(sizeof(Header));
+                for (size_t count: section_sizes(header)) {
+                    expected = aligned(expected + count * sizeof(uint32_t));
+                }
+                return expected == header.file_size;
+            }
+
+            // the ids a query follows stay inside the table, so a damaged snapshot can not send it out of bounds;
+            // the mapping has to match its header
+            static bool consistent(const MappedFile &mapping) {
+                using namespace snapshot_format;
+                Header header{};
+                memcpy(&header, mapping.data(), sizeof(header));
+                auto sizes = section_sizes(header);
+                array<const uint32_t *, 10> sections{};
+                size_t offset = aligned(sizeof(Header));
+                for (size_t i = 0; i < sizes.size(); i++) {
+                    sections[i] = reinterpret_cast<const uint32_t *>(mapping.data() + offset);
+                    offset = aligned(offset + sizes[i] * sizeof(uint32_t));
+                }
+                const uint32_t *house_station = sections[4];
+                const uint32_t *offsets = sections[7];
+                const uint32_t *ids = sections[8];
+                for (size_t h = 0; h < header.house_count; h++) {
+                    if (house_station[h] >= header.station_count && house_station[h] != HouseStationTable::no_station) {
+                        return false;
+                    }
+                }
+                if (offsets[0] != 0 || offsets[header.station_count] != header.assigned_count) {
+                    return false;
+                }
+                for (size_t s = 0; s < header.station_count; s++) {
+                    if (offsets[s + 1] < offsets[s]) {
+                        return false;
+                    }
+                }
+                for (size_t i = 0; i < header.assigned_count; i++) {
+                    if (ids[i] >= header.house_count) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            unique_ptr<MappedFile> mapping;
+        };
+    }
+
+    namespace processing_core {
+        using processing_types::HouseStationMap;
+        using processing_types::RunLengthMap;
+        using processing_types::CellRun;
+        using processing_types::HouseStationSet;
+        using processing_types::HouseStationTable;
+        using processing_types::House;
+        using processing_types::Station;
+        using processing_types::NearestStationField;
+        using processing_types::TextData;
+        using IO::ReadFile;
+        using IO::MappedReadFile;
+        using IO::RunLengthReadFile;
+        using math_utils::distance_func;
+        using math_utils::squared_distance;
+        using spatial_index::PointGridIndex;
+        using spatial_index::GrowingPointGrid;
+        using spatial_index::StationArrays;
+        using concurrency_utils::ThreadPool;
+        using scan_kernels::find_equal;
+        using scan_kernels::find_not_equal;
+        using concurrency_utils::SpscQueue;
+        using concurrency_utils::QueueStats;
+
+        // nearest_station(house) returns a position in hs_set.stations or PointGridIndex::npos
+        template<typename NearestStation>
+        HouseStationTable build_house_station_table(const HouseStationSet &hs_set,
+                                                    NearestStation nearest_station) {
+            HouseStationTable hs_table;
+            const size_t station_count = hs_set.stations.size();
+            hs_table.station_x.resize(station_count);
+            hs_table.station_y.resize(station_count);
+            for (const auto &j: hs_set.stations) {
+                if (j.station_number >= station_count) {
+                    throw ProcessingException("Station numbers are expected to be dense!");
+                }
+                hs_table.station_x[j.station_number] = j.x_center;
+                hs_table.station_y[j.station_number] = j.y_center;
+            }
+            const size_t house_count = hs_set.houses.size();
+            hs_table.house_x.resize(house_count);
+            hs_table.house_y.resize(house_count);
+            hs_table.house_width.resize(house_count);
+            hs_table.house_height.resize(house_count);
+            hs_table.house_station.resize(house_count);
+            for (const auto &i: hs_set.houses) {
+                if (i.house_number >= house_count) {
+                    throw ProcessingException("House numbers are expected to be dense!");
+                }
+                size_t nearest = nearest_station(i);
+                hs_table.house_x[i.house_number] = i.x_center;
+                hs_table.house_y[i.house_number] = i.y_center;
+                hs_table.house_width[i.house_number] = i.x_size;
+                hs_table.house_height[i.house_number] = i.y_size;
+                hs_table.house_station[i.house_number] = nearest == PointGridIndex::npos
+                                                          ? HouseStationTable::no_station
+                                                          : static_cast<uint32_t>(hs_set.stations[nearest].station_number);
+            }
+            hs_table.index_station_houses();
+            return hs_table;
+        }
+
+        class HousesStationTracer : public DataProcessor {
+        public:
+            static const char *name() {
+                return "HousesStationTracer";
+            }
+
+            shared_ptr<ProcessingData> process(shared_ptr<ProcessingData> pd) override {
+                if (auto rl_map = dynamic_pointer_cast<RunLengthMap>(pd)) {
+                    return make_shared<HouseStationSet>(apply(*rl_map));
+                }
+                auto hs_map = dynamic_pointer_cast<HouseStationMap>(pd);
+                if (!hs_map) {
+                    throw ProcessingDataTypeMissmatch("Data types missmatch: expected HouseStationMap in HSSearch!");
+                }
+                return make_shared<HouseStationSet>(apply(*hs_map));
+            }
+
+            HouseStationSet apply(const HouseStationMap &hs_map) const {
+                return trace(hs_map);
+            }
+
+            HouseStationSet apply(const RunLengthMap &rl_map) const {
+                return trace(rl_map);
+            }
+
+            // scans rows [first_row, last_row) and appends what starts there, numbering on from the sizes of hs_set;
+            // houses are followed below last_row, so ranges can be traced independently
+            static void trace_rows(const HouseStationMap &hs_map, uint32_t first_row, uint32_t last_row,
+                                   HouseStationSet &hs_set) {
+                size_t house_counter = hs_set.houses.size();
+                size_t station_counter = hs_set.stations.size();
+                const uint32_t x_size = hs_map.x_size;
+                // empty cells are skipped by the vectorized finders
+                auto next_cell = [x_size](const uint8_t *row, uint32_t from) {
+                    return static_cast<uint32_t>(find_not_equal(row, from, x_size, 0));
+                };
+                for (uint32_t i = first_row; i < last_row; i++) {
+                    const uint8_t *row = hs_map.row(i);
+                    for (uint32_t j = next_cell(row, 0); j < x_size; j = next_cell(row, j + 1)) {
+                        if (row[j] == 2) {
+                            hs_set.stations.push_back({j, i, station_counter++});
+                        }
+                        if (row[j] == 1) {
+                            if (i != 0 && hs_map.row(i - 1)[j] == 1) {
+                                j = static_cast<uint32_t>(find_not_equal(row, j + 1, x_size, 1) - 1);
+                            } else {
+                                uint32_t y_house_size = i;
+                                uint32_t x_house_size = j;
+                                while (y_house_size < hs_map.y_size - 1 &&
+                                       hs_map.row(y_house_size + 1)[x_house_size] != 0) {
+                                    y_house_size++;
+                                }
+                                x_house_size = static_cast<uint32_t>(
+                                        find_equal(hs_map.row(y_house_size), j + 1, x_size, 0) - 1);
+                                x_house_size++;
+                                y_house_size++;
+                                uint32_t tmp = j;
+                                j = x_house_size;
+                                uint32_t middle_x_cords = tmp + (x_house_size - tmp) / 2;
+                                uint32_t middle_y_cords = i + (y_house_size - i) / 2;
+                                hs_set.houses.push_back(
+                                        {middle_x_cords, middle_y_cords, x_house_size - tmp, y_house_size - i,
+                                         house_counter++});
+                            }
+                        }
+                    }
+                }
+            }
+
+            // the same walk over runs: a station run is a station per cell, a house run that continues one from
+            // the row above is skipped whole, and only the vertical walk of a new house looks cells up
+            static void trace_rows(const RunLengthMap &rl_map, uint32_t first_row, uint32_t last_row,
+                                   HouseStationSet &hs_set) {
+                size_t house_counter = hs_set.houses.size();
+                size_t station_counter = hs_set.stations.size();
+                for (uint32_t i = first_row; i < last_row; i++) {
+                    const CellRun *run = rl_map.row_begin(i);
+                    const CellRun *row_end = rl_map.row_end(i);
+                    const CellRun *above = i != 0 ? rl_map.row_begin(i - 1) : nullptr;
+                    const CellRun *above_end = i != 0 ? rl_map.row_end(i - 1) : nullptr;
+                    uint32_t j = 0;
+                    while (true) {
+                        while (run != row_end && run->end() <= j) {
+                            run++;
+                        }
+                        if (run == row_end) {
+                            break;
+                        }
+                        j = max(j, run->x);
+                        if (run->value() == 2) {
+                            for (; j < run->end(); j++) {
+                                hs_set.stations.push_back({j, i, station_counter++});
+                            }
+                            continue;
+                        }
+                        while (above != above_end && above->end() <= j) {
+                            above++;
+                        }
+                        if (above != above_end && above->x <= j && above->value() == 1) {
+                            j = run->end();
+                            continue;
+                        }
+                        uint32_t y_house_size = i;
+                        while (y_house_size < rl_map.y_size - 1 && rl_map.cell(j, y_house_size + 1) != 0) {
+                            y_house_size++;
+                        }
+                        uint32_t x_house_size = rl_map.find_empty(y_house_size, j + 1);
+                        y_house_size++;
+                        hs_set.houses.push_back(
+                                {j + (x_house_size - j) / 2, i + (y_house_size - i) / 2, x_house_size - j,
+                                 y_house_size - i, house_counter++});
+                        j = x_house_size + 1;
+                    }
+                }
+            }
+
+        private:
+            template<typename Map>
+            static HouseStationSet trace(const Map &map) {
+                HouseStationSet hs_set;
+                hs_set.x_size = map.x_size;
+                hs_set.y_size = map.y_size;
+                trace_rows(map, 0, map.y_size, hs_set);
+                return hs_set;
+            }
+        };
+
+        // HousesStationTracer over row bands on a thread pool; a band follows its houses into the rows below it,
+        // so the merged set is exactly the single-threaded one
+        class ParallelHousesStationTracer : public DataProcessor {
+        public:
+            static const char *name() {
+                return "ParallelHousesStationTracer";
+            }
+
+            explicit ParallelHousesStationTracer(size_t thread_count = ThreadPool::default_thread_count())
+                    : thread_count(max<size_t>(thread_count, 1)) {}
+
+            shared_ptr<ProcessingData> process(shared_ptr<ProcessingData> pd) override {
+                if (auto rl_map = dynamic_pointer_cast<RunLengthMap>(pd)) {
+                    return make_shared<HouseStationSet>(apply(*rl_map));
+                }
+                auto hs_map = dynamic_pointer_cast<HouseStationMap>(pd);
+                if (!hs_map) {
+                    throw ProcessingDataTypeMissmatch(
+                            "Data types missmatch: expected HouseStationMap in ParallelHousesStationTracer!");
+                }
+                return make_shared<HouseStationSet>(apply(*hs_map));
+            }
+
+            HouseStationSet apply(const HouseStationMap &hs_map) const {
+                return trace(hs_map);
+            }
+
+            HouseStationSet apply(const RunLengthMap &rl_map) const {
+                return trace(rl_map);
+            }
+
+        private:
+            template<typename Map>
+            HouseStationSet trace(const Map &hs_map) const {
+                HouseStationSet hs_set;
+                hs_set.x_size = hs_map.x_size;
+                hs_set.y_size = hs_map.y_size;
+
+                // a few bands per thread so uneven bands still balance
+                size_t band_count = min<size_t>(thread_count * 4, max<uint32_t>(hs_map.y_size / min_band_rows, 1));
+                uint32_t band_rows = static_cast<uint32_t>((hs_map.y_size + band_count - 1) / band_count);
+                vector<HouseStationSet> bands(band_count);
+                {
+                    ThreadPool pool(min(thread_count, band_count));
+                    vector<future<void>> pending;
+                    for (size_t b = 0; b < band_count; b++) {
+                        uint32_t first = static_cast<uint32_t>(min<size_t>(b * band_rows, hs_map.y_size));
+                        uint32_t last = static_cast<uint32_t>(min<size_t>(first + size_t(band_rows), hs_map.y_size));
+                        pending.push_back(pool.submit([&, b, first, last] {
+                            HousesStationTracer::trace_rows(hs_map, first, last, bands[b]);
+                        }));
+                    }
+                    for (auto &band: pending) {
+                        band.get();
+                    }
+                }
+
+                size_t house_total = 0, station_total = 0;
+                for (const auto &band: bands) {
+                    house_total += band.houses.size();
+                    station_total += band.stations.size();
+                }
+                hs_set.houses.reserve(house_total);
+                hs_set.stations.reserve(station_total);
+                for (auto &band: bands) {
+                    size_t house_offset = hs_set.houses.size();
+                    size_t station_offset = hs_set.stations.size();
+                    for (auto &house: band.houses) {
+                        house.house_number += house_offset;
+                        hs_set.houses.push_back(house);
+                    }
+                    for (auto &station: band.stations) {
+                        station.station_number += station_offset;
+                        hs_set.stations.push_back(station);
+                    }
+                }
+                return hs_set;
+            }
+
+            static constexpr uint32_t min_band_rows = 64;
+            size_t thread_count;
+        };
+
+        // HousesStationTracer fed one row at a time: houses stay open while their first column continues below
+        // and get their width from their last row once it is known. Only the previous row is kept, so the width
+        // skipped on the top row is measured on that row; for rectangular houses the result is the same
+        class IncrementalHousesTracer {
+        public:
+            IncrementalHousesTracer(uint32_t x_size, uint32_t y_size, bool track_closed = false)
+                    : previous_row(x_size), track_closed(track_closed) {
+                hs_set.x_size = x_size;
+                hs_set.y_size = y_size;
+            }
+
+            void feed_row(const uint8_t *row) {
+                const uint32_t x_size = hs_set.x_size;
+                const uint32_t i = next_row;
+                size_t kept = 0;
+                for (const auto &house: open_houses) {
+                    if (row[house.x_start] != 0) {
+                        open_houses[kept++] = house;
+                    } else {
+                        close_house(house, i - 1);
+                    }
+                }
+                open_houses.resize(kept);
+
+                for (uint32_t j = next_cell(row, 0); j < x_size; j = next_cell(row, j + 1)) {
+                    if (row[j] == 2) {
+                        hs_set.stations.push_back({j, i, hs_set.stations.size()});
+                    }
+                    if (row[j] == 1) {
+                        if (i != 0 && previous_row[j] == 1) {
+                            j = static_cast<uint32_t>(find_not_equal(row, j + 1, x_size, 1) - 1);
+                        } else {
+                            open_houses.push_back({j, i, hs_set.houses.size()});
+                            hs_set.houses.push_back({0, 0, 0, 0, hs_set.houses.size()});
+                            j = static_cast<uint32_t>(find_equal(row, j + 1, x_size, 0));
+                        }
+                    }
+                }
+                copy(row, row + x_size, previous_row.begin());
+                next_row++;
+            }
+
+            // closes the houses that reach the last row, call after feeding all rows
+            HouseStationSet &finish() {
+                for (const auto &house: open_houses) {
+                    close_house(house, next_row - 1);
+                }
+                open_houses.clear();
+                return hs_set;
+            }
+
+            [[nodiscard]] size_t open_house_count() const {
+                return open_houses.size();
+            }
+
+            // houses and stations traced so far, a house is complete once its slot came out of take_closed
+            [[nodiscard]] const HouseStationSet &traced() const {
+                return hs_set;
+            }
+
+            // slots of the houses closed since the last call, needs track_closed
+            vector<size_t> take_closed() {
+                vector<size_t> slots;
+                slots.swap(closed_slots);
+                return slots;
+            }
+
+        private:
+            struct OpenHouse {
+                uint32_t x_start;
+                uint32_t y_start;
+                size_t slot;
+            };
+
+            [[nodiscard]] uint32_t next_cell(const uint8_t *row, uint32_t from) const {
+                return static_cast<uint32_t>(find_not_equal(row, from, hs_set.x_size, 0));
+            }
+
+            // previous_row still holds last_row here
+            void close_house(const OpenHouse &house, uint32_t last_row) {
+                auto x_end = static_cast<uint32_t>(find_equal(previous_row.data(), house.x_start + 1, hs_set.x_size, 0));
+                uint32_t y_end = last_row + 1;
+                auto &h = hs_set.houses[house.slot];
+                h.x_center = house.x_start + (x_end - house.x_start) / 2;
+                h.y_center = house.y_start + (y_end - house.y_start) / 2;
+                h.x_size = x_end - house.x_start;
+                h.y_size = y_end - house.y_start;
+                if (track_closed) {
+                    closed_slots.push_back(house.slot);
+                }
+            }
+
+            HouseStationSet hs_set;
+            vector<uint8_t> previous_row;
+            vector<OpenHouse> open_houses;
+            uint32_t next_row = 0;
+            bool track_closed;
+            vector<size_t> closed_slots;
+        };
+
+        // reads the header with the checks of ReadFile and leaves the stream at the first cell
+        inline ifstream open_map_stream(const string &path, uint32_t &x_size, uint32_t &y_size) {
+            ifstream fileStream;
+            fileStream.open(path, ios::binary);
+            if (!fileStream.is_open()) {
+                throw ProcessingException("No such file or directory!");
+            }
+            fileStream.read(reinterpret_cast<char *>(&x_size), sizeof(x_size));
+            fileStream.read(reinterpret_cast<char *>(&y_size), sizeof(y_size));
+            if (!fileStream) {
+                throw ProcessingException("File is invalid, less data, then expected");
+            }
+            fileStream.seekg(0, ios::end);
+            size_t fileSize = fileStream.tellg();
+            fileStream.seekg(ReadFile::header_size, ios::beg);
+            if (fileSize - ReadFile::header_size < static_cast<size_t>(x_size) * y_size) {
+                throw ProcessingException("File is invalid, less data, then expected");
+            }
+            profiling::count_bytes_read(ReadFile::header_size);
+            return fileStream;
+        }
+
+        // reads the map file in bands of rows and traces them right away, so memory use depends on band_bytes
+        // and the map width only; the whole map never has to fit in memory
+        class StreamingHousesStationTracer : public DataProcessor {
+        public:
+            explicit StreamingHousesStationTracer(size_t band_bytes = size_t(64) << 20) : band_bytes(band_bytes) {}
+
+            shared_ptr<ProcessingData> process(shared_ptr<ProcessingData> processingData) override {
+                auto file_name = dynamic_pointer_cast<TextData>(processingData);
+                if (!file_name) {
+                    throw ProcessingDataTypeMissmatch(
+                            "Data missmatch in StreamingHousesStationTracer, expected TextData!");
+                }
+                uint32_t x_size;
+                uint32_t y_size;
+                ifstream fileStream = open_map_stream(file_name->text, x_size, y_size);
+                IncrementalHousesTracer tracer(x_size, y_size);
+                size_t band_rows = clamp<size_t>(band_bytes / max<uint32_t>(x_size, 1), 1, max<uint32_t>(y_size, 1));
+                vector<uint8_t> band(band_rows * x_size);
+                for (uint32_t first = 0; first < y_size; first += static_cast<uint32_t>(band_rows)) {
+                    uint32_t rows = static_cast<uint32_t>(min<size_t>(band_rows, y_size - first));
+                    fileStream.read(reinterpret_cast<char *>(band.data()), static_cast<streamsize>(size_t(rows) * x_size));
+                    profiling::count_bytes_read(size_t(rows) * x_size);
+                    for (uint32_t r = 0; r < rows; r++) {
+                        tracer.feed_row(band.data() + size_t(r) * x_size);
+                    }
+                }
+                return make_shared<HouseStationSet>(std::move(tracer.finish()));
+            }
+
+        private:
+            size_t band_bytes;
+        };
+
+        // reading, tracing and station assignment run on their own threads at once: bands of rows go from the
+        // reader to the tracer and closed houses with new stations go from the tracer to the assignment, both
+        // through bounded queues. A house is assigned as soon as no station in the rows not read yet can beat it.
+        class StagedMapProcessor : public DataProcessor {
+        public:
+            explicit StagedMapProcessor(size_t band_bytes = size_t(4) << 20, size_t queue_depth = 4)
+                    : band_bytes(band_bytes), queue_depth(max<size_t>(queue_depth, 1)) {}
+
+            shared_ptr<ProcessingData> process(shared_ptr<ProcessingData> processingData) override {
+                auto file_name = dynamic_pointer_cast<TextData>(processingData);
+                if (!file_name) {
+                    throw ProcessingDataTypeMissmatch("Data missmatch in StagedMapProcessor, expected TextData!");
+                }
+                uint32_t x_size;
+                uint32_t y_size;
+                ifstream fileStream = open_map_stream(file_name->text, x_size, y_size);
+
+                const size_t band_rows = clamp<size_t>(band_bytes / max<uint32_t>(x_size, 1), 1, max<uint32_t>(y_size, 1));
+                // one band being read and one being traced on top of the queued ones
+                vector<vector<uint8_t>> bands(queue_depth + 2, vector<uint8_t>(band_rows * x_size));
+                SpscQueue<RowBand> read_queue(queue_depth);
+                SpscQueue<size_t> free_bands(bands.size());
+                SpscQueue<TracedBand> traced_queue(queue_depth);
+                HouseStationSet hs_set;
+                vector<size_t> assigned;
+
+                thread reader([&] {
+                    size_t unused = 0;
+                    for (uint32_t first = 0; first < y_size; first += static_cast<uint32_t>(band_rows)) {
+                        RowBand band{0, static_cast<uint32_t>(min<size_t>(band_rows, y_size - first))};
+                        if (unused < bands.size()) {
+                            band.buffer = unused++;
+                        } else {
+                            free_bands.pop(band.buffer);
+                        }
+                        fileStream.read(reinterpret_cast<char *>(bands[band.buffer].data()),
+                                        static_cast<streamsize>(size_t(band.rows) * x_size));
+                        profiling::count_bytes_read(size_t(band.rows) * x_size);
+                        read_queue.push(band);
+                    }
+                    read_queue.close();
+                });
+
+                thread tracer([&] {
+                    IncrementalHousesTracer tracer(x_size, y_size, true);
+                    size_t sent_stations = 0;
+                    uint32_t rows_done = 0;
+                    RowBand band{};
+                    while (read_queue.pop(band)) {
+                        const uint8_t *rows = bands[band.buffer].data();
+                        for (uint32_t r = 0; r < band.rows; r++) {
+                            tracer.feed_row(rows + size_t(r) * x_size);
+                        }
+                        free_bands.push(band.buffer);
+                        rows_done += band.rows;
+                        traced_queue.push(take_traced(tracer, sent_stations, rows_done));
+                    }
+                    tracer.finish();
+                    traced_queue.push(take_traced(tracer, sent_stations, y_size));
+                    traced_queue.close();
+                    hs_set = std::move(tracer.finish());
+                });
+
+                thread assigner([&] {
+                    assign_stations(traced_queue, x_size, y_size, assigned);
+                });
+
+                reader.join();
+                tracer.join();
+                assigner.join();
+
+                report_queue(cerr, "READ->TRACE", read_queue.stats());
+                report_queue(cerr, "TRACE->ASSIGN", traced_queue.stats());
+                assigned.resize(hs_set.houses.size(), PointGridIndex::npos);
+                return make_shared<HouseStationTable>(build_house_station_table(hs_set, [&assigned](const auto &house) {
+                    return assigned[house.house_number];
+                }));
+            }
+
+        private:
+            struct RowBand {
+                size_t buffer;
+                uint32_t rows;
+            };
+
+            struct TracedBand {
+                vector<House> houses;
+                vector<Station> stations;
+                uint32_t rows_done = 0;
+            };
+
+            static TracedBand take_traced(IncrementalHousesTracer &tracer, size_t &sent_stations, uint32_t rows_done) {
+                TracedBand traced;
+                const auto &hs_set = tracer.traced();
+                for (size_t slot: tracer.take_closed()) {
+                    traced.houses.push_back(hs_set.houses[slot]);
+                }
+                traced.stations.assign(hs_set.stations.begin() + static_cast<ptrdiff_t>(sent_stations),
+                                       hs_set.stations.end());
+                sent_stations = hs_set.stations.size();
+                traced.rows_done = rows_done;
+                return traced;
+            }
+
+            // a station in a row not read yet is at least rows_done - y_center away and comes later in scan order,
+            // so it loses ties; a house whose best distance is within that is final
+            static void assign_stations(SpscQueue<TracedBand> &traced_queue, uint32_t x_size, uint32_t y_size,
+                                        vector<size_t> &assigned) {
+                auto cell_size = static_cast<uint32_t>(sqrt(double(x_size) * double(y_size)) / 64);
+                GrowingPointGrid stations(x_size, y_size, max<uint32_t>(cell_size, 16));
+                // houses with the row at which it is worth asking again
+                vector<pair<House, uint32_t>> pending;
+                TracedBand traced;
+                while (traced_queue.pop(traced)) {
+                    for (const auto &station: traced.stations) {
+                        stations.insert(station.x_center, station.y_center, station.station_number);
+                    }
+                    for (const auto &house: traced.houses) {
+                        pending.emplace_back(house, 0);
+                    }
+                    const bool last = traced.rows_done == y_size;
+                    size_t kept = 0;
+                    for (const auto &entry: pending) {
+                        const House &house = entry.first;
+                        if (!last && entry.second > traced.rows_done) {
+                            pending[kept++] = entry;
+                            continue;
+                        }
+                        auto best = stations.nearest(house.x_center, house.y_center);
+                        if (last || (best.id != PointGridIndex::npos &&
+                                     best.settled(int64_t(traced.rows_done - house.y_center)))) {
+                            if (assigned.size() <= house.house_number) {
+                                assigned.resize(house.house_number + 1, PointGridIndex::npos);
+                            }
+                            assigned[house.house_number] = best.id;
+                        } else {
+                            uint32_t recheck = traced.rows_done + 1;
+                            if (best.id != PointGridIndex::npos) {
+                                recheck = max(recheck, house.y_center + static_cast<uint32_t>(ceil(best.distance())));
+                            }
+                            pending[kept++] = {house, recheck};
+                        }
+                    }
+                    pending.resize(kept);
+                }
+            }
+
+            static void report_queue(ostream &out, const char *name, const QueueStats &stats) {
+                double average = stats.pushes == 0 ? 0 : double(stats.occupancy_sum) / double(stats.pushes);
+                out << "QUEUE " << name << ": AVERAGE OCCUPANCY " << average << "/" << stats.capacity
+                    << ", PRODUCER WAITS " << stats.full_waits << ", CONSUMER WAITS " << stats.empty_waits << endl;
+            }
+
+            size_t band_bytes;
+            size_t queue_depth;
+        };
+
+        class HouseStationSetProcessor : public DataProcessor {
+        public:
+            static const char *name() {
+                return "HouseStationSetProcessor";
+            }
+
+            HouseStationSetProcessor() = default;
+
+            shared_ptr<ProcessingData> process(shared_ptr<ProcessingData> data) override {
+                auto hs_set = dynamic_pointer_cast<HouseStationSet>(data);
+                if (!hs_set) {
+                    throw ProcessingDataTypeMissmatch(
+                            "Data missmatch in HouseStationSetProcessor: expected HouseStationSet");
+                }
+                return make_shared<HouseStationTable>(apply(*hs_set));
+            }
+
+            // up to this many stations a brute force pass over all of them beats building and searching the grid
+            static constexpr size_t brute_force_stations = 128;
+
+            HouseStationTable apply(const HouseStationSet &hs_set) const {
+                if (hs_set.stations.size() <= brute_force_stations) {
+                    vector<size_t> nearest = StationArrays(hs_set.stations).nearest(hs_set.houses);
+                    const House *first = hs_set.houses.data();
+                    return build_house_station_table(hs_set, [&nearest, first](const auto &house) {
+                        return nearest[size_t(&house - first)];
+                    });
+                }
+                PointGridIndex station_index(hs_set.stations);
+                return build_house_station_table(hs_set, [&station_index](const auto &house) {
+                    return station_index.nearest(house.x_center, house.y_center);
+                });
+            }
+        };
+
+        // exact Euclidean feature transform (Meijster et al.) over the whole map, O(x_size * y_size);
+        // a replacement for HouseStationSetProcessor on dense maps, houses read the station of their centre cell.
+        // Stations at exactly the same distance may resolve differently from HouseStationSetProcessor.
+        class StationFeatureTransform : public DataProcessor {
+        public:
+            static const char *name() {
+                return "StationFeatureTransform";
+            }
+
+            StationFeatureTransform() = default;
+
+            shared_ptr<ProcessingData> process(shared_ptr<ProcessingData> data) override {
+                auto hs_set = dynamic_pointer_cast<HouseStationSet>(data);
+                if (!hs_set) {
+                    throw ProcessingDataTypeMissmatch(
+                            "Data missmatch in StationFeatureTransform: expected HouseStationSet");
+                }
+                return make_shared<HouseStationTable>(apply(*hs_set));
+            }
+
+            HouseStationTable apply(const HouseStationSet &hs_set) const {
+                auto field = compute_field(hs_set);
+                auto hs_table = build_house_station_table(hs_set, [&field](const auto &house) {
+                    uint32_t station = field->station_at(house.x_center, house.y_center);
+                    return station == NearestStationField::no_station ? PointGridIndex::npos : size_t(station);
+                });
+                hs_table.station_field = field;
+                return hs_table;
+            }
+
+            static shared_ptr<NearestStationField> compute_field(const HouseStationSet &hs_set) {
+                const uint32_t width = hs_set.x_size;
+                const uint32_t height = hs_set.y_size;
+                auto field = make_shared<NearestStationField>(width, height);
+                auto &nearest = field->nearest;
+                const auto &stations = hs_set.stations;
+                const uint32_t none = NearestStationField::no_station;
+                for (uint32_t s = 0; s < stations.size(); s++) {
+                    size_t cell = size_t(stations[s].y_center) * width + stations[s].x_center;
+                    if (nearest[cell] == none) {
+                        nearest[cell] = s;
+                    }
+                }
+                if (stations.empty() || width == 0 || height == 0) {
+                    return field;
+                }
+
+                // phase 1: nearest station within each column, the upper one wins a tie
+                for (uint32_t x = 0; x < width; x++) {
+                    for (uint32_t y = 1; y < height; y++) {
+                        size_t cell = size_t(y) * width + x;
+                        if (nearest[cell] == none) {
+                            nearest[cell] = nearest[cell - width];
+                        }
+                    }
+                    for (uint32_t y = height - 1; y-- > 0;) {
+                        size_t cell = size_t(y) * width + x;
+                        uint32_t below = nearest[cell + width];
+                        if (below == none) {
+                            continue;
+                        }
+                        if (nearest[cell] == none ||
+                            int64_t(stations[below].y_center) - y < y - int64_t(stations[nearest[cell]].y_center)) {
+                            nearest[cell] = below;
+                        }
+                    }
+                }
+
+                // phase 2: lower envelope of the column parabolas along every row
+                vector<uint32_t> row(width);
+                vector<uint32_t> envelope(width);
+                vector<int64_t> starts(width);
+                for (uint32_t y = 0; y < height; y++) {
+                    uint32_t *out = nearest.data() + size_t(y) * width;
+                    copy(out, out + width, row.begin());
+                    auto g = [&](uint32_t u) {
+                        int64_t dy = int64_t(stations[row[u]].y_center) - y;
+                        return dy * dy;
+                    };
+                    auto f = [&](int64_t x, uint32_t u) {
+                        return (x - u) * (x - u) + g(u);
+                    };
+                    auto separation = [&](uint32_t i, uint32_t u) {
+                        int64_t num = int64_t(u) * u - int64_t(i) * i + g(u) - g(i);
+                        int64_t den = 2 * (int64_t(u) - i);
+                        return num >= 0 ? num / den : -((-num + den - 1) / den);
+                    };
+                    int64_t q = -1;
+                    for (uint32_t u = 0; u < width; u++) {
+                        if (row[u] == none) {
+                            continue;
+                        }
+                        while (q >= 0 && f(starts[q], envelope[q]) > f(starts[q], u)) {
+                            q--;
+                        }
+                        if (q < 0) {
+                            q = 0;
+                            envelope[0] = u;
+                            starts[0] = 0;
+                        } else {
+                            int64_t w = 1 + separation(envelope[q], u);
+                            if (w < width) {
+                                q++;
+                                envelope[q] = u;
+                                starts[q] = w;
+                            }
+                        }
+                    }
+                    for (int64_t x = int64_t(width) - 1; x >= 0; x--) {
+                        out[x] = row[envelope[q]];
+                        if (x == starts[q]) {
+                            q--;
+                        }
+                    }
+                }
+                return field;
+            }
+        };
+
+        // a map delivered as a grid of tiles in a directory: every file named <name>_<column>_<row>.<extension>, raw
+        // or run-length, is one tile; tiles of a column share their width and tiles of a row their height.
+        // Tiles are read and traced in parallel and houses cut by tile edges are stitched together. Each tile then
+        // assigns the houses centred in it from its own stations and the stations within `halo` cells in its
+        // neighbours; only a house that could have a closer station beyond that goes to an index of all stations.
+        // For rectangular houses the table is the one tracing the assembled map gives
+        class TiledMapProcessor : public DataProcessor {
+        public:
+            static const char *name() {
+                return "TiledMapProcessor";
+            }
+
+            explicit TiledMapProcessor(size_t thread_count = ThreadPool::default_thread_count(), uint32_t halo = 64)
+                    : thread_count(max<size_t>(thread_count, 1)), halo(halo) {}
+
+            shared_ptr<ProcessingData> process(shared_ptr<ProcessingData> data) override {
+                auto directory = dynamic_pointer_cast<TextData>(data);
+                if (!directory) {
+                    throw ProcessingDataTypeMissmatch("Data missmatch in TiledMapProcessor, expected TextData!");
+                }
+                return make_shared<HouseStationTable>(apply(*directory));
+            }
+
+            HouseStationTable apply(const TextData &directory) const {
+                vector<Tile> tiles = find_tiles(directory.text);
+                ThreadPool pool(min(thread_count, tiles.size()));
+                vector<HouseStationSet> traced(tiles.size());
+                run_parallel(pool, tiles.size(), [&](size_t t) {
+                    TextData file_name;
+                    file_name.text = tiles[t].path;
+                    traced[t] = IO::run_length_format::is_run_length_file(file_name.text)
+                                ? HousesStationTracer().apply(RunLengthReadFile().apply(file_name))
+                                : HousesStationTracer().apply(MappedReadFile().apply(file_name));
+                });
+                Layout layout = lay_out(tiles, traced);
+
+                // every traced house as a rectangle on the whole map, tile by tile
+                vector<Rectangle> fragments;
+                vector<size_t> first_fragment(tiles.size() + 1, 0);
+                for (size_t t = 0; t < tiles.size(); t++) {
+                    first_fragment[t] = fragments.size();
+                    for (const auto &house: traced[t].houses) {
+                        uint32_t x0 = tiles[t].x0 + house.x_center - house.x_size / 2;
+                        uint32_t y0 = tiles[t].y0 + house.y_center - house.y_size / 2;
+                        fragments.push_back({x0, y0, x0 + house.x_size, y0 + house.y_size});
+                    }
+                }
+                first_fragment[tiles.size()] = fragments.size();
+                vector<Rectangle> houses = stitch(tiles, layout, fragments, first_fragment);
+                // numbered as a trace of the whole map would: by top row, then left column
+                sort(houses.begin(), houses.end(), [](const Rectangle &a, const Rectangle &b) {
+                    return a.y0 != b.y0 ? a.y0 < b.y0 : a.x0 < b.x0;
+                });
+
+                HouseStationSet hs_set;
+                hs_set.x_size = layout.x_size;
+                hs_set.y_size = layout.y_size;
+                for (size_t t = 0; t < tiles.size(); t++) {
+                    for (const auto &station: traced[t].stations) {
+                        hs_set.stations.push_back(
+                                {tiles[t].x0 + station.x_center, tiles[t].y0 + station.y_center, 0});
+                    }
+                }
+                traced.clear();
+                sort(hs_set.stations.begin(), hs_set.stations.end(), [](const Station &a, const Station &b) {
+                    return a.y_center != b.y_center ? a.y_center < b.y_center : a.x_center < b.x_center;
+                });
+                for (size_t i = 0; i < hs_set.stations.size(); i++) {
+                    hs_set.stations[i].station_number = i;
+                }
+                hs_set.houses.reserve(houses.size());
+                for (size_t i = 0; i < houses.size(); i++) {
+                    const Rectangle &house = houses[i];
+                    hs_set.houses.push_back({house.x0 + (house.x1 - house.x0) / 2,
+                                             house.y0 + (house.y1 - house.y0) / 2,
+                                             house.x1 - house.x0, house.y1 - house.y0, i});
+                }
+
+                vector<size_t> assigned = assign_stations(pool, tiles, layout, hs_set);
+                if (auto *profiler = profiling::active_profiler()) {
+                    profiler->tile_pieces_stitched += fragments.size() - houses.size();
+                    profiler->tile_houses_beyond_halo += fallback_count(assigned);
+                }
+                PointGridIndex all_stations;
+                bool all_stations_built = false;
+                return build_house_station_table(hs_set, [&](const House &house) {
+                    size_t nearest = assigned[house.house_number];
+                    if (nearest != beyond_halo) {
+                        return nearest;
+                    }
+                    if (!all_stations_built) {
+                        all_stations.build(hs_set.stations);
+                        all_stations_built = true;
+                    }
+                    return all_stations.nearest(house.x_center, house.y_center);
+                });
+            }
+
+        private:
+            struct Tile {
+                string path;
+                uint32_t column;
+                uint32_t row;
+                // its cells on the whole map, known once every tile is traced
+                uint32_t x0 = 0;
+                uint32_t y0 = 0;
+                uint32_t x1 = 0;
+                uint32_t y1 = 0;
+            };
+
+            // column and row starts on the whole map, with the map size as the last entry
+            struct Layout {
+                uint32_t columns = 0;
+                uint32_t rows = 0;
+                vector<uint32_t> column_x;
+                vector<uint32_t> row_y;
+                uint32_t x_size = 0;
+                uint32_t y_size = 0;
+
+                [[nodiscard]] size_t tile_at(uint32_t column, uint32_t row) const {
+                    return size_t(row) * columns + column;
+                }
+            };
+
+            // [x0, x1) x [y0, y1)
+            struct Rectangle {
+                uint32_t x0;
+                uint32_t y0;
+                uint32_t x1;
+                uint32_t y1;
+            };
+
+            static constexpr size_t beyond_halo = spatial_index::npos - 1;
+
+            // waits for every task before rethrowing the first failure, the others still use body and its captures
+            template<typename Body>
+            static void run_parallel(ThreadPool &pool, size_t count, Body body) {
+                vector<future<void>> pending;
+                for (size_t i = 0; i < count; i++) {
+                    pending.push_back(pool.submit([&body, i] { body(i); }));
+                }
+                exception_ptr failure;
+                for (auto &task: pending) {
+                    try {
+                        task.get();
+                    } catch (...) {
+                        if (!failure) {
+                            failure = current_exception();
+                        }
+                    }
+                }
+                if (failure) {
+                    rethrow_exception(failure);
+                }
+            }
+
+            // the tiles in row-major order, the grid has to be complete
+            static vector<Tile> find_tiles(const string &directory) {
+                error_code error;
+                filesystem::directory_iterator entries(directory, error);
+                if (error) {
+                    throw ProcessingException("Can not read the tile directory!");
+                }
+                vector<Tile> tiles;
+                uint32_t columns = 0, rows = 0;
+                for (const auto &entry: entries) {
+                    if (!entry.is_regular_file(error)) {
+                        continue;
+                    }
+                    string stem = entry.path().stem().string();
+                    size_t row_start = stem.rfind('_');
+                    size_t column_start = row_start == string::npos || row_start == 0
+                                          ? string::npos : stem.rfind('_', row_start - 1);
+                    auto is_number = [](const string &text) {
+                        return !text.empty() && text.size() < 10 && all_of(text.begin(), text.end(), [](char c) {
+                            return isdigit(static_cast<unsigned char>(c)) != 0;
+                        });
+                    };
+                    if (column_start == string::npos ||
+                        !is_number(stem.substr(column_start + 1, row_start - column_start - 1)) ||
+                        !is_number(stem.substr(row_start + 1))) {
+                        continue;
+                    }
+                    Tile tile;
+                    tile.path = entry.path().string();
+                    tile.column = static_cast<uint32_t>(stoul(stem.substr(column_start + 1,
+                                                                          row_start - column_start - 1)));
+                    tile.row = static_cast<uint32_t>(stoul(stem.substr(row_start + 1)));
+                    columns = max(columns, tile.column + 1);
+                    rows = max(rows, tile.row + 1);
+                    tiles.push_back(std::move(tile));
+                }
+                if (tiles.empty()) {
+                    throw ProcessingException("No <name>_<column>_<row> tiles found in the directory!");
+                }
+                sort(tiles.begin(), tiles.end(), [](const Tile &a, const Tile &b) {
+                    return a.row != b.row ? a.row < b.row : a.column < b.column;
+                });
+                for (size_t t = 0; t < tiles.size(); t++) {
+                    if (tiles.size() != size_t(columns) * rows || tiles[t].row != t / columns ||
+                        tiles[t].column != t % columns) {
+                        throw ProcessingException("Tiles are expected to form a complete grid!");
+                    }
+                }
+                return tiles;
+            }
+
+            static Layout lay_out(vector<Tile> &tiles, const vector<HouseStationSet> &traced) {
+                Layout layout;
+                layout.columns = tiles.back().column + 1;
+                layout.rows = tiles.back().row + 1;
+                layout.column_x.assign(layout.columns + 1, 0);
+                layout.row_y.assign(layout.rows + 1, 0);
+                for (uint32_t c = 0; c < layout.columns; c++) {
+                    layout.column_x[c + 1] = layout.column_x[c] + traced[layout.tile_at(c, 0)].x_size;
+                }
+                for (uint32_t r = 0; r < layout.rows; r++) {
+                    layout.row_y[r + 1] = layout.row_y[r] + traced[layout.tile_at(0, r)].y_size;
+                }
+                for (size_t t = 0; t < tiles.size(); t++) {
+                    Tile &tile = tiles[t];
+                    tile.x0 = layout.column_x[tile.column];
+                    tile.x1 = layout.column_x[tile.column + 1];
+                    tile.y0 = layout.row_y[tile.row];
+                    tile.y1 = layout.row_y[tile.row + 1];
+                    if (traced[t].x_size != tile.x1 - tile.x0 || traced[t].y_size != tile.y1 - tile.y0) {
+                        throw ProcessingException(
+                                "Tiles of a column (row) are expected to share their width (height)!");
+                    }
+                }
+                layout.x_size = layout.column_x.back();
+                layout.y_size = layout.row_y.back();
+                return layout;
+            }
+
+            // joins the pieces that touch across a tile edge, rectangles of the joined houses in no order
+            static vector<Rectangle> stitch(const vector<Tile> &tiles, const Layout &layout,
+                                            const vector<Rectangle> &fragments, const vector<size_t> &first_fragment) {
+                vector<size_t> parent(fragments.size());
+                iota(parent.begin(), parent.end(), 0);
+                auto find_root = [&parent](size_t i) {
+                    while (parent[i] != i) {
+                        parent[i] = parent[parent[i]];
+                        i = parent[i];
+                    }
+                    return i;
+                };
+                // pieces of two tiles on either side of one edge, compared along the edge
+                auto join_across = [&](size_t before, size_t after, bool vertical_edge) {
+                    uint32_t edge = vertical_edge ? tiles[before].x1 : tiles[before].y1;
+                    auto along = [vertical_edge](const Rectangle &r) {
+                        return vertical_edge ? make_pair(r.y0, r.y1) : make_pair(r.x0, r.x1);
+                    };
+                    vector<size_t> ending, starting;
+                    for (size_t f = first_fragment[before]; f < first_fragment[before + 1]; f++) {
+                        if ((vertical_edge ? fragments[f].x1 : fragments[f].y1) == edge) {
+                            ending.push_back(f);
+                        }
+                    }
+                    for (size_t f = first_fragment[after]; f < first_fragment[after + 1]; f++) {
+                        if ((vertical_edge ? fragments[f].x0 : fragments[f].y0) == edge) {
+                            starting.push_back(f);
+                        }
+                    }
+                    auto by_start = [&](size_t a, size_t b) { return along(fragments[a]) < along(fragments[b]); };
+                    sort(ending.begin(), ending.end(), by_start);
+                    sort(starting.begin(), starting.end(), by_start);
+                    size_t i = 0, j = 0;
+                    while (i < ending.size() && j < starting.size()) {
+                        auto a = along(fragments[ending[i]]);
+                        auto b = along(fragments[starting[j]]);
+                        if (a.first < b.second && b.first < a.second) {
+                            parent[find_root(ending[i])] = find_root(starting[j]);
+                        }
+                        a.second <= b.second ? i++ : j++;
+                    }
+                };
+                for (uint32_t r = 0; r < layout.rows; r++) {
+                    for (uint32_t c = 0; c < layout.columns; c++) {
+                        if (c + 1 < layout.columns) {
+                            join_across(layout.tile_at(c, r), layout.tile_at(c + 1, r), true);
+                        }
+                        if (r + 1 < layout.rows) {
+                            join_across(layout.tile_at(c, r), layout.tile_at(c, r + 1), false);
+                        }
+                    }
+                }
+
+                vector<Rectangle> houses;
+                vector<size_t> house_of(fragments.size(), SIZE_MAX);
+                for (size_t f = 0; f < fragments.size(); f++) {
+                    size_t root = find_root(f);
+                    if (house_of[root] == SIZE_MAX) {
+                        house_of[root] = houses.size();
+                        houses.push_back(fragments[f]);
+                    }
+                    Rectangle &house = houses[house_of[root]];
+                    house.x0 = min(house.x0, fragments[f].x0);
+                    house.y0 = min(house.y0, fragments[f].y0);
+                    house.x1 = max(house.x1, fragments[f].x1);
+                    house.y1 = max(house.y1, fragments[f].y1);
+                }
+                return houses;
+            }
+
+            // the position in hs_set.stations of every house's station, beyond_halo where the tile can not tell
+            vector<size_t> assign_stations(ThreadPool &pool, const vector<Tile> &tiles, const Layout &layout,
+                                           const HouseStationSet &hs_set) const {
+                auto tile_of = [&layout](uint32_t x, uint32_t y) {
+                    auto column = uint32_t(upper_bound(layout.column_x.begin(), layout.column_x.end() - 1, x) -
+                                           layout.column_x.begin() - 1);
+                    auto row = uint32_t(upper_bound(layout.row_y.begin(), layout.row_y.end() - 1, y) -
+                                        layout.row_y.begin() - 1);
+                    return layout.tile_at(column, row);
+                };
+                vector<vector<uint32_t>> tile_stations(tiles.size());
+                for (const auto &station: hs_set.stations) {
+                    tile_stations[tile_of(station.x_center, station.y_center)].push_back(
+                            static_cast<uint32_t>(station.station_number));
+                }
+                vector<vector<uint32_t>> tile_houses(tiles.size());
+                for (const auto &house: hs_set.houses) {
+                    tile_houses[tile_of(house.x_center, house.y_center)].push_back(
+                            static_cast<uint32_t>(house.house_number));
+                }
+
+                vector<size_t> assigned(hs_set.houses.size(), beyond_halo);
+                run_parallel(pool, tiles.size(), [&](size_t t) {
+                    const Tile &tile = tiles[t];
+                    // the tile and the parts of its neighbours within the halo
+                    auto width = [&layout](int64_t column) {
+                        return int64_t(layout.column_x[column + 1] - layout.column_x[column]);
+                    };
+                    auto height = [&layout](int64_t row) {
+                        return int64_t(layout.row_y[row + 1] - layout.row_y[row]);
+                    };
+                    int64_t left = tile.column > 0 ? tile.x0 - min<int64_t>(halo, width(tile.column - 1)) : 0;
+                    int64_t right = tile.column + 1 < layout.columns
+                                    ? tile.x1 + min<int64_t>(halo, width(tile.column + 1)) : int64_t(layout.x_size);
+                    int64_t top = tile.row > 0 ? tile.y0 - min<int64_t>(halo, height(tile.row - 1)) : 0;
+                    int64_t bottom = tile.row + 1 < layout.rows
+                                     ? tile.y1 + min<int64_t>(halo, height(tile.row + 1)) : int64_t(layout.y_size);
+                    vector<uint32_t> candidates;
+                    for (int64_t r = int64_t(tile.row) - 1; r <= int64_t(tile.row) + 1; r++) {
+                        for (int64_t c = int64_t(tile.column) - 1; c <= int64_t(tile.column) + 1; c++) {
+                            if (r < 0 || c < 0 || r >= layout.rows || c >= layout.columns) {
+                                continue;
+                            }
+                            for (uint32_t id: tile_stations[layout.tile_at(uint32_t(c), uint32_t(r))]) {
+                                const Station &station = hs_set.stations[id];
+                                if (station.x_center >= left && station.x_center < right &&
+                                    station.y_center >= top && station.y_center < bottom) {
+                                    candidates.push_back(id);
+                                }
+                            }
+                        }
+                    }
+                    // ascending ids keep the ties of the index of all stations
+                    sort(candidates.begin(), candidates.end());
+                    vector<Station> candidate_points;
+                    candidate_points.reserve(candidates.size());
+                    for (uint32_t id: candidates) {
+                        candidate_points.push_back(hs_set.stations[id]);
+                    }
+                    PointGridIndex station_index(candidate_points);
+                    for (uint32_t id: tile_houses[t]) {
+                        const House &house = hs_set.houses[id];
+                        size_t nearest = station_index.nearest(house.x_center, house.y_center);
+                        if (nearest == PointGridIndex::npos) {
+                            continue;
+                        }
+                        // the closest a station outside the searched area can be
+                        int64_t bound = INT64_MAX;
+                        if (left > 0) {
+                            bound = min<int64_t>(bound, int64_t(house.x_center) - left + 1);
+                        }
+                        if (right < layout.x_size) {
+                            bound = min<int64_t>(bound, right - int64_t(house.x_center));
+                        }
+                        if (top > 0) {
+                            bound = min<int64_t>(bound, int64_t(house.y_center) - top + 1);
+                        }
+                        if (bottom < layout.y_size) {
+                            bound = min<int64_t>(bound, bottom - int64_t(house.y_center));
+                        }
+                        const Station &station = candidate_points[nearest];
+                        uint64_t distance = squared_distance(house.x_center, house.y_center, station.x_center,
+                                                             station.y_center);
+                        if (bound == INT64_MAX || distance < uint64_t(bound) * uint64_t(bound)) {
+                            assigned[id] = candidates[nearest];
+                        }
+                    }
+                });
+                return assigned;
+            }
+
+            static size_t fallback_count(const vector<size_t> &assigned) {
+                return size_t(count(assigned.begin(), assigned.end(), beyond_halo));
+            }
+
+            size_t thread_count;
+            uint32_t halo;
+        };
+    }
+
+    namespace pipeline {
+        using processing_types::TextData;
+        using namespace IO;
+        using namespace UI;
+        using namespace processing_core;
+        using namespace tiny_database;
+
+        class PipeLine {
+        public:
+            explicit PipeLine(const vector<shared_ptr<DataProcessor>> &dp, shared_ptr<FinalProcessingUnit> &pl_ending)
+                    : processors(dp), pipe_line_ending(pl_ending) {}
+
+            void initiate_pipe_line(const shared_ptr<ProcessingData> &init_data) {
+                shared_ptr<ProcessingData> last_return = init_data;
+                while (true) {
+                    try {
+                        last_return = this->process_next(last_return);
+                        if (last_return == nullptr) {
+                            break;
+                        }
+                    } catch (ProcessingDataTypeMissmatch &e) {
+                        cerr << e.what() << endl;
+                        break;
+                    } catch (ProcessingException &e) {
+                        cerr << e.what() << endl;
+                        break;
+                    }
+                }
+            }
+
+            shared_ptr<ProcessingData> process_next(shared_ptr<ProcessingData> &pd) {
+                if (pipe_line_counter < processors.size()) {
+                    auto &processor = processors[pipe_line_counter++];
+                    if (auto *profiler = profiling::active_profiler()) {
+                        return profiler->time_stage(profiling::type_name(typeid(*processor)),
+                                                    [&] { return processor->process(pd); });
+                    }
+                    return processor->process(pd);
+                }
+                pipe_line_ending->process(pd);
+                return nullptr;
+            }
+
+        private:
+            vector<shared_ptr<DataProcessor>> processors;
+            shared_ptr<FinalProcessingUnit> pipe_line_ending;
+            size_t pipe_line_counter = 0;
+        };
+
+        template<typename Stage, typename Input, typename = void>
+        struct accepts : false_type {
+        };
+
+        template<typename Stage, typename Input>
+        struct accepts<Stage, Input, void_t<decltype(declval<Stage &>().apply(declval<Input>()))>> : true_type {
+        };
+
+        // PipeLine with the stages fixed at compile time: every stage's apply() takes the previous result by value
+        // or reference and returns its own by value, so a stage that does not fit fails to compile instead of
+        // throwing ProcessingDataTypeMissmatch, and the calls between stages can be inlined. Stages also
+        // give a static name() for the profile, so nothing here needs RTTI
+        template<typename... Stages>
+        class TypedPipeLine {
+        public:
+            explicit TypedPipeLine(Stages... stages) : stages(std::move(stages)...) {}
+
+            template<typename Input>
+            auto run(Input &&input) {
+                return run_from<0>(std::forward<Input>(input));
+            }
+
+            // runs the stages and hands the result to pl_ending, errors are printed like in PipeLine
+            template<typename Input>
+            void initiate_pipe_line(Input &&input, const shared_ptr<FinalProcessingUnit> &pl_ending) {
+                using Result = decltype(run(std::forward<Input>(input)));
+                shared_ptr<Result> result;
+                try {
+                    result = make_shared<Result>(run(std::forward<Input>(input)));
+                } catch (ProcessingException &e) {
+                    cerr << e.what() << endl;
+                    return;
+                }
+                try {
+                    pl_ending->process(std::move(result));
+                } catch (ProcessingDataTypeMissmatch &e) {
+                    cerr << e.what() << endl;
+                } catch (ProcessingException &e) {
+                    cerr << e.what() << endl;
+                }
+            }
+
+        private:
+            template<size_t I, typename Data>
+            auto run_from(Data &&data) {
+                if constexpr (I == sizeof...(Stages)) {
+                    return decay_t<Data>(std::forward<Data>(data));
+                } else {
+                    using Stage = tuple_element_t<I, tuple<Stages...>>;
+                    static_assert(accepts<Stage, decay_t<Data>>::value,
+                                  "TypedPipeLine: a stage can not take the output of the stage before it");
+                    // the input is released before the later stages run, as PipeLine drops it between stages
+                    auto next = [this](decay_t<Data> input) {
+                        if (auto *profiler = profiling::active_profiler()) {
+                            return profiler->time_stage(Stage::name(),
+                                                        [&] { return get<I>(stages).apply(std::move(input)); });
+                        }
+                        return get<I>(stages).apply(std::move(input));
+                    }(std::forward<Data>(data));
+                    return run_from<I + 1>(std::move(next));
+                }
+            }
+
+            tuple<Stages...> stages;
+        };
+
+        template<typename... Stages>
+        TypedPipeLine<Stages...> make_typed_pipe_line(Stages... stages) {
+            return TypedPipeLine<Stages...>(std::move(stages)...);
+        }
+
+        struct ProcessingOptions {
+            // assign stations through StationFeatureTransform instead of HouseStationSetProcessor
+            bool dense_map = false;
+            // worker threads for the parallel stages, 1 keeps everything on the calling thread
+            size_t threads = concurrency_utils::ThreadPool::default_thread_count();
+            // read and trace the file in bands of this many bytes instead of loading it whole, 0 disables
+            size_t stream_band_bytes = 0;
+            // answer the commands of this file ("-" for stdin) with BatchUI instead of starting the console
+            string batch_input;
+            // serve the commands on this socket address with SocketServerUI instead, replaces batch_input
+            string serve_address;
+            // load the finished table from <file>.snapshot when it matches the file, write it otherwise
+            bool use_snapshot = false;
+            // collect stage timings, counters and command latencies for STATS
+            bool profile = false;
+            // also write them as JSON to this file at exit, implies profile
+            string profile_json;
+            // read, trace and assign stations concurrently with StagedMapProcessor, replaces the options above
+            // that pick the tracer and the assignment; stream_band_bytes sets its band size when given.
+            // Both are ignored for run-length files, which are mapped whole
+            bool staged = false;
+            // when the source is a directory of tiles (see TiledMapProcessor): how far each tile looks into its
+            // neighbours for stations. Tiles replace the options that pick the reader, tracer and assignment
+            uint32_t tile_halo = 64;
+            // memory budget of the cached command answers, 0 disables the cache
+            size_t result_cache_bytes = ResultCacheOptions().bytes;
+            // cache the STATTRACE answers of this many stations with the most houses before the first command
+            size_t warm_stations = 0;
+        };
+
+        inline void run_map_processing(string &file_name, const ProcessingOptions &options) {
+            error_code error;
+            const bool tiled = filesystem::is_directory(file_name, error);
+            if (tiled && options.use_snapshot) {
+                cerr << "Snapshots are not supported for tile directories, run without --snapshot" << endl;
+                return;
+            }
+            auto td = make_shared<TextData>();
+            td->text = file_name;
+            ResultCacheOptions cache_options{options.result_cache_bytes, options.warm_stations, options.threads};
+            shared_ptr<FinalProcessingUnit> concole_UI;
+            if (!options.serve_address.empty()) {
+                concole_UI = make_shared<SocketServerUI>(options.serve_address, options.threads, cache_options);
+            } else if (options.batch_input.empty()) {
+                concole_UI = make_shared<ConsoleUI>(cache_options);
+            } else {
+                concole_UI = make_shared<BatchUI>(options.batch_input, options.threads, cout, cache_options);
+            }
+            if (tiled) {
+                make_typed_pipe_line(TiledMapProcessor(options.threads, options.tile_halo))
+                        .initiate_pipe_line(*td, concole_UI);
+                return;
+            }
+            // run-length files are traced on their runs; streaming reads the raw layout, so they are mapped whole
+            bool run_length = run_length_format::is_run_length_file(file_name);
+            bool whole_file = run_length || (!options.staged && options.stream_band_bytes == 0);
+            // the default chain has all its types known here, so it skips the casts of PipeLine
+            if (!options.use_snapshot && whole_file && !options.dense_map) {
+                if (run_length && options.threads > 1) {
+                    make_typed_pipe_line(RunLengthReadFile(), ParallelHousesStationTracer(options.threads),
+                                         HouseStationSetProcessor()).initiate_pipe_line(*td, concole_UI);
+                } else if (run_length) {
+                    make_typed_pipe_line(RunLengthReadFile(), HousesStationTracer(),
+                                         HouseStationSetProcessor()).initiate_pipe_line(*td, concole_UI);
+                } else if (options.threads > 1) {
+                    make_typed_pipe_line(MappedReadFile(), ParallelHousesStationTracer(options.threads),
+                                         HouseStationSetProcessor()).initiate_pipe_line(*td, concole_UI);
+                } else {
+                    make_typed_pipe_line(MappedReadFile(), HousesStationTracer(),
+                                         HouseStationSetProcessor()).initiate_pipe_line(*td, concole_UI);
+                }
+                return;
+            }
+            vector<shared_ptr<DataProcessor>> pd;
+            const bool staged = options.staged && !whole_file;
+            // StagedMapProcessor assigns the nearest station whatever dense_map says
+            auto assignment = options.dense_map && !staged ? snapshot_format::feature_transform
+                                                           : snapshot_format::nearest_station;
+            auto snapshot = options.use_snapshot ? LoadSnapshot::open(file_name, assignment) : nullptr;
+            if (snapshot) {
+                pd.push_back(snapshot);
+            } else {
+                if (staged) {
+                    pd.push_back(options.stream_band_bytes != 0
+                                 ? make_shared<StagedMapProcessor>(options.stream_band_bytes)
+                                 : make_shared<StagedMapProcessor>());
+                } else {
+                    if (!whole_file) {
+                        pd.push_back(make_shared<StreamingHousesStationTracer>(options.stream_band_bytes));
+                    } else if (run_length) {
+                        pd.push_back(make_shared<RunLengthReadFile>());
+                    } else {
+                        pd.push_back(make_shared<MappedReadFile>());
+                    }
+                    if (whole_file && options.threads > 1) {
+                        pd.push_back(make_shared<ParallelHousesStationTracer>(options.threads));
+                    } else if (whole_file) {
+                        pd.push_back(make_shared<HousesStationTracer>());
+                    }
+                    if (options.dense_map) {
+                        pd.push_back(make_shared<StationFeatureTransform>());
+                    } else {
+                        pd.push_back(make_shared<HouseStationSetProcessor>());
+                    }
+                }
+                if (options.use_snapshot) {
+                    pd.push_back(make_shared<SaveSnapshot>(file_name, assignment));
+                }
+            }
+            auto pl = new PipeLine(pd, concole_UI);
+            pl->initiate_pipe_line(td);
+            delete pl;
+        }
+
+        inline void start_map_processing(string &file_name, const ProcessingOptions &options = {}) {
+            if (!options.profile && options.profile_json.empty()) {
+                run_map_processing(file_name, options);
+                return;
+            }
+            profiling::Profiler profiler;
+            profiling::active_profiler() = &profiler;
+            run_map_processing(file_name, options);
+            profiling::active_profiler() = nullptr;
+            if (!options.profile_json.empty()) {
+                ofstream file(options.profile_json, ios::trunc);
+                output_utils::StreamSink sink(file);
+                {
+                    BufferedWriter out(sink);
+                    profiler.write_json(out);
+                }
+                if (!file) {
+                    cerr << "Can not write the profile " << options.profile_json << endl;
+                }
+            }
+        }
+    }
+
+}
+
+#endif //TEST_TASK_MAP_PROCESSING_H